@@ -30,6 +30,19 @@ class ApiManager {
             std::unique_ptr<io::SourceInterface> source,
             std::unique_ptr<io::TargetInterface> target) = 0;
 
+    /**
+     * Process from a file descriptor to a custom sink. libvips maps the file
+     * (if possible), so that it's read without copies and with random access.
+     * @param query Query string.
+     * @param descriptor File descriptor to read from, this is duplicated
+     *                   (the caller remains the owner).
+     * @param target Target to write to.
+     * @return A Status object to represent an error or an OK state.
+     */
+    virtual utils::Status
+    process_descriptor(const std::string &query, int descriptor,
+                       std::unique_ptr<io::TargetInterface> target) = 0;
+
     /**
      * Process from and to a file.
      * @param query Query string.
@@ -8,6 +8,19 @@ using io::Target;
 using utils::Status;
 using vips::VError;
 
+// Report the constant image cache statistics every this many lookups
+const uint64_t CACHE_STATS_INTERVAL = 1000;
+
+// Report the content-aware output statistics every this many classified
+// images
+const uint64_t CONTENT_STATS_INTERVAL = 1000;
+
+// The statistics are kept per thread (images may be processed on a thread
+// pool), and so is the number of lookups and classified images at the time
+// of their last report
+thread_local uint64_t reported_lookups = 0;
+thread_local uint64_t reported_classified = 0;
+
 std::shared_ptr<ApiManager>
 ApiManagerFactory::create_api_manager(std::unique_ptr<ApiEnvInterface> env) {
     return std::shared_ptr<ApiManager>(new ApiManagerImpl(std::move(env)));
@@ -33,7 +46,8 @@ ApiManagerImpl::ApiManagerImpl(std::unique_ptr<ApiEnvInterface> env)
     int vips_result = vips_init("weserv");
     if (vips_result == 0) {
         /* Disable the libvips cache -- it won't help and will just burn
-         * memory.
+         * memory. The LUTs that are derived from the query are kept in our
+         * own, bounded cache instead, see utils/cache.h.
          */
         vips_cache_set_max(0);
 
@@ -60,6 +74,49 @@ void ApiManagerImpl::clean_up() {
     vips_thread_shutdown();
 }
 
+void ApiManagerImpl::log_cache_stats() {
+    auto stats = utils::cache_stats();
+    if (stats.lookups < reported_lookups + CACHE_STATS_INTERVAL) {
+        return;
+    }
+
+    reported_lookups = stats.lookups;
+
+    auto hit_rate = static_cast<int>(
+        std::rint(100.0 * static_cast<double>(stats.hits) /
+                  static_cast<double>(stats.lookups)));
+
+    env_->log_info("Constant image cache: " + std::to_string(stats.hits) +
+                   " hits of " + std::to_string(stats.lookups) +
+                   " lookups (" + std::to_string(hit_rate) + "%), " +
+                   std::to_string(stats.entries) + " images using " +
+                   std::to_string(stats.memory) + " bytes");
+}
+
+void ApiManagerImpl::log_content_stats() {
+    auto stats = utils::content_stats();
+    if (stats.classified < reported_classified + CONTENT_STATS_INTERVAL) {
+        return;
+    }
+
+    reported_classified = stats.classified;
+
+    // Estimated on the previews the images were classified on
+    auto saved = stats.origin_bytes == 0
+                     ? 0
+                     : static_cast<int>(std::rint(
+                           100.0 -
+                           100.0 * static_cast<double>(stats.output_bytes) /
+                               static_cast<double>(stats.origin_bytes)));
+
+    env_->log_info("Content-aware output: " +
+                   std::to_string(stats.classified) + " images classified (" +
+                   std::to_string(stats.graphics) + " graphics), " +
+                   std::to_string(stats.converted) +
+                   " converted, saving an estimated " + std::to_string(saved) +
+                   "% bytes on those");
+}
+
 Status ApiManagerImpl::exception_handler(const std::string &query) {
     try {
         // Clean up libvips' per-request data and threads
@@ -122,46 +179,49 @@ utils::Status ApiManagerImpl::process(const std::string &query,
     // Image processors
     auto trim = processors::Trim(query_holder);
     auto thumbnail = processors::Thumbnail(query_holder);
-    auto orientation = processors::Orientation(query_holder);
     auto alignment = processors::Alignment(query_holder);
-    auto crop = processors::Crop(query_holder);
-    auto embed = processors::Embed(query_holder);
-    auto rotation = processors::Rotation(query_holder);
-    auto brightness = processors::Brightness(query_holder);
-    auto contrast = processors::Contrast(query_holder);
-    auto gamma = processors::Gamma(query_holder);
-    auto sharpen = processors::Sharpen(query_holder);
-    auto filter = processors::Filter(query_holder);
-    auto blur = processors::Blur(query_holder);
-    auto tint = processors::Tint(query_holder);
-    auto background = processors::Background(query_holder);
-    auto mask = processors::Mask(query_holder);
-    auto saturate = processors::Saturate(query_holder);
+    auto decimation = processors::Decimation(query_holder);
+    auto pipeline = processors::Pipeline(query_holder);
 
     // Create image from a source
     auto image = stream.new_from_source(source);
 
-    // Image processing phase 1 (make sure trimming is done first)
-    image = image | trim;
+    // Image processing phase 1 (find the trim area and the interesting area
+    // for smart crops on shrunk previews, and the identical frames of
+    // animations, this allows us to stay sequential)
+    // Note: the interesting area depends on the trim area.
+    trim.resolve_area(image, source);
+    alignment.resolve_interest(image, source);
+    decimation.resolve_duplicates(image, source);
 
-    // Image processing phase 2 (size, crop, etc.)
-    if (precrop) {
-        image = image | orientation | crop | thumbnail | alignment;
-    } else {
-        // The very fast shrink-on-load tricks are possible
+    // The very fast shrink-on-load tricks are possible
+    if (!precrop) {
         image = thumbnail.shrink_on_load(image, source);
-        image = image | thumbnail | orientation | alignment | crop;
     }
 
-    // Image processing phase 3 (adjustments, effects, etc.)
-    image = image | embed | rotation | brightness | contrast | gamma | sharpen |
-            filter | blur | tint | background | mask | saturate;
+    // Plan image processing phase 2 (size, crop, etc.) and phase 3
+    // (adjustments, effects, etc.)
+    pipeline.plan(image);
 
-    // Write the image to a target
-    stream.write_to_target(image, target);
+    if (query_holder->get<bool>("explain", false)) {
+        // Write the plan instead of the image
+        std::string out = pipeline.to_json();
+
+        target.setup(".json");
+        target.write(out.c_str(), out.size());
+        target.finish();
+    } else {
+        image = image | pipeline;
+
+        // Write the image to a target
+        stream.write_to_target(image, target);
+    }
 
     // Clean up libvips' per-request data and threads
     clean_up();
+
+    log_cache_stats();
+    log_content_stats();
   
     return Status::OK;
 }
@@ -179,6 +239,18 @@ ApiManagerImpl::process(const std::string &query,
     }
 }
 
+utils::Status
+ApiManagerImpl::process_descriptor(const std::string &query,
+                                   const int descriptor,
+                                   std::unique_ptr<io::TargetInterface> target) {
+    try {
+        return process(query, Source::new_from_descriptor(descriptor),
+                       Target::new_to_pointer(std::move(target)));
+    } catch (...) {
+        return exception_handler(query);
+    }
+}
+
 utils::Status ApiManagerImpl::process_file(const std::string &query,
                                            const std::string &in_file,
                                            const std::string &out_file) {
@@ -6,24 +6,16 @@
 #include "parsers/query.h"
 
 #include "processors/alignment.h"
-#include "processors/background.h"
-#include "processors/blur.h"
-#include "processors/brightness.h"
-#include "processors/contrast.h"
-#include "processors/crop.h"
-#include "processors/embed.h"
-#include "processors/filter.h"
-#include "processors/gamma.h"
-#include "processors/mask.h"
-#include "processors/orientation.h"
-#include "processors/rotation.h"
-#include "processors/saturate.h"
-#include "processors/sharpen.h"
+#include "processors/decimation.h"
+#include "processors/pipeline.h"
 #include "processors/stream.h"
 #include "processors/thumbnail.h"
-#include "processors/tint.h"
 #include "processors/trim.h"
 
+#include "utils/cache.h"
+#include "utils/content.h"
+
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <utility>
@@ -47,6 +39,10 @@ class ApiManagerImpl : public ApiManager {
                           std::unique_ptr<io::SourceInterface> source,
                           std::unique_ptr<io::TargetInterface> target) override;
 
+    utils::Status
+    process_descriptor(const std::string &query, int descriptor,
+                       std::unique_ptr<io::TargetInterface> target) override;
+
     utils::Status process_file(const std::string &query,
                                const std::string &in_file,
                                const std::string &out_file) override;
@@ -65,6 +61,18 @@ class ApiManagerImpl : public ApiManager {
      */
     void clean_up();
 
+    /**
+     * Log the hit rate of the constant image cache, at most once per
+     * interval of cache lookups.
+     */
+    void log_cache_stats();
+
+    /**
+     * Log the outputs selected for `&output=auto`, at most once per interval
+     * of classified images.
+     */
+    void log_content_stats();
+
     /**
      * Lippincott function to centralize the exception handling logic.
      * @param query The query string for this request, handy for debugging.
@@ -52,20 +52,33 @@ enum class ImageType {
     Svg,
     Pdf,
     Heif,
+    Jxl,
     Magick,
     Unknown
 };
 
 enum class Output {
     Origin,  // Default
+    Auto,    // Negotiated with the Accept request header
     Jpeg,
     Png,
     Webp,
     Tiff,
     Gif,
+    Avif,
+    Jxl,
     Json
 };
 
+enum class WebpPreset {
+    Default = VIPS_FOREIGN_WEBP_PRESET_DEFAULT,  // Default
+    Picture = VIPS_FOREIGN_WEBP_PRESET_PICTURE,
+    Photo = VIPS_FOREIGN_WEBP_PRESET_PHOTO,
+    Drawing = VIPS_FOREIGN_WEBP_PRESET_DRAWING,
+    Icon = VIPS_FOREIGN_WEBP_PRESET_ICON,
+    Text = VIPS_FOREIGN_WEBP_PRESET_TEXT
+};
+
 enum class Canvas {
     Max,  // Default
     Min,
@@ -75,6 +75,23 @@ Source Source::new_from_file(const std::string &filename) {
     return Source(source);
 }
 
+Source Source::new_from_descriptor(const int descriptor) {
+    // The duplicated descriptor shares the file offset, which may have been
+    // left anywhere by a previous reader of the (cached) descriptor
+    if (lseek(descriptor, 0, SEEK_SET) == -1) {
+        throw exceptions::UnreadableImageException(
+            "unable to seek to the start of the image");
+    }
+
+    VipsSource *source = vips_source_new_from_descriptor(descriptor);
+
+    if (source == nullptr) {
+        throw vips::VError();
+    }
+
+    return Source(source);
+}
+
 Source Source::new_from_buffer(const std::string &buffer) {
     VipsSource *source =
         vips_source_new_from_memory(buffer.c_str(), buffer.size());
@@ -115,6 +132,27 @@ Source Source::new_from_file(const std::string &filename) {
     return Source(buffer.str());
 }
 
+Source Source::new_from_descriptor(const int descriptor) {
+    char temp_buffer[SOURCE_BUFFER_SIZE];
+    std::string buffer;
+    ssize_t bytes_read;
+
+    // Read with explicit offsets, the descriptor may be shared
+    do {
+        bytes_read = pread(descriptor, temp_buffer, SOURCE_BUFFER_SIZE,
+                           static_cast<off_t>(buffer.size()));
+
+        if (bytes_read == -1) {
+            throw exceptions::UnreadableImageException(
+                "read error while buffering image");
+        }
+
+        buffer.append(temp_buffer, bytes_read);
+    } while (bytes_read > 0);
+
+    return Source(buffer);
+}
+
 Source Source::new_from_buffer(const std::string &buffer) {
     return Source(buffer);
 }
@@ -4,12 +4,13 @@
 
 #include <memory>
 #include <string>
+#include <unistd.h>
 #include <vips/vips8>
 
+#include "exceptions/unreadable.h"
 #include "utils/utility.h"
 
 #if !VIPS_VERSION_AT_LEAST(8, 10, 0)
-#include "exceptions/unreadable.h"
 #include <fstream>
 #include <utility>
 #endif
@@ -74,6 +75,15 @@ class Source {
      */
     static Source new_from_file(const std::string &filename);
 
+    /**
+     * Create a source attached to a file descriptor. The descriptor is
+     * duplicated (it remains owned by the caller) and needs to be seekable,
+     * so that libvips can map the file.
+     * @param descriptor Read from this file descriptor.
+     * @return A new Source class.
+     */
+    static Source new_from_descriptor(int descriptor);
+
     /**
      * Create a source attached to an area of memory.
      * @param buffer Memory area to load.
@@ -105,14 +105,37 @@ inline enums::Output parse(const std::string &value) {
         return enums::Output::Tiff;
     } else if (value == "webp") {
         return enums::Output::Webp;
+    } else if (value == "avif") {
+        return enums::Output::Avif;
+    } else if (value == "jxl") {
+        return enums::Output::Jxl;
     } else if (value == "json") {
         return enums::Output::Json;
+    } else if (value == "auto") {
+        return enums::Output::Auto;
     } else /*if (value == "origin")*/ {
         // Honor the origin image format by default
         return enums::Output::Origin;
     }
 }
 
+template <>
+inline enums::WebpPreset parse(const std::string &value) {
+    if (value == "picture") {
+        return enums::WebpPreset::Picture;
+    } else if (value == "photo") {
+        return enums::WebpPreset::Photo;
+    } else if (value == "drawing") {
+        return enums::WebpPreset::Drawing;
+    } else if (value == "icon") {
+        return enums::WebpPreset::Icon;
+    } else if (value == "text") {
+        return enums::WebpPreset::Text;
+    } else /*if (value == "default")*/ {
+        return enums::WebpPreset::Default;
+    }
+}
+
 template <>
 inline enums::Canvas parse(const std::string &value) {
     // Deprecated parameters
@@ -9,9 +9,10 @@ using enums::FilterType;
 using enums::MaskType;
 using enums::Output;
 using enums::Position;
+using enums::WebpPreset;
 
-// `&[precrop]=true`
-constexpr size_t MAX_KEY_LENGTH = sizeof("precrop") - 1;
+// `&[nearlossless]=true`
+constexpr size_t MAX_KEY_LENGTH = sizeof("nearlossless") - 1;
 
 // Note: We check the `MAX_VALUE_LENGTH` within `numeric.h`
 
@@ -51,16 +52,44 @@ const TypeMap &type_map = {
         {"rbg",     typeid(Color)},
         {"tint",    typeid(Color)},
         {"q",       typeid(int)},
+        {"maxbytes", typeid(int)},
+        {"effort",  typeid(int)},
+        {"chroma",  typeid(int)},
         {"l",       typeid(int)},
         {"output",  typeid(Output)},
+        {"accept",  typeid(std::vector<Output>)},  // Set by the nginx module
         {"il",      typeid(bool)},
+        {"mozjpeg", typeid(bool)},
+        {"trellis", typeid(bool)},
+        {"deringing", typeid(bool)},
+        {"scans",   typeid(bool)},
+        {"qtable",  typeid(int)},
+        {"restart", typeid(int)},
         {"af",      typeid(bool)},
+        {"palette", typeid(bool)},
+        {"colours", typeid(int)},
+        {"dither",  typeid(float)},
+        {"bitdepth", typeid(int)},
+        {"reuse",   typeid(bool)},
+        {"interframe", typeid(float)},
+        {"lossless", typeid(bool)},
+        {"nearlossless", typeid(bool)},
+        {"smartsub", typeid(bool)},
+        {"preset",  typeid(WebpPreset)},
+        {"minsize", typeid(bool)},
+        {"kmin",    typeid(int)},
+        {"kmax",    typeid(int)},
+        {"webp_effort", typeid(int)},  // Set by the nginx module
+        {"png_threads", typeid(int)},  // Set by the nginx module
         {"page",    typeid(int)},
         {"n",       typeid(int)},
         {"loop",    typeid(int)},               // TODO(kleisauke): Documentation needed.
         {"delay",   typeid(std::vector<int>)},  // TODO(kleisauke): Documentation needed.
         {"fsol",    typeid(bool)},              // TODO(kleisauke): Documentation needed.
+        {"fps",     typeid(float)},
+        {"maxframes", typeid(int)},
         {"sat",     typeid(float)},
+        {"explain", typeid(bool)},
 };
 
 const SynonymMap &synonym_map = {
@@ -75,6 +104,7 @@ const SynonymMap &synonym_map = {
         {"align",   "a"},
         {"level",   "l"},
         {"quality", "q"},
+        {"colors",  "colours"},
 };
 // clang-format on
 
@@ -120,6 +150,9 @@ void add_value(QueryMap &map, const std::string &key, const std::string &value,
         // Only emplace `false` if it's explicitly specified because we
         // interpret empty strings (for e.g. `&we`) as `true`.
         map.emplace(key, value != "false" && value != "0");
+    } else if (key == "q" && value == "auto") {
+        // The quality is searched for while saving
+        map.emplace("q_auto", true);
     } else if (type == typeid(int)) {
         try {
             map.emplace(key, parse<int>(value));
@@ -198,6 +231,16 @@ void add_value(QueryMap &map, const std::string &key, const std::string &value,
         map.emplace(key, utils::underlying_value(parse<MaskType>(value)));
     } else if (type == typeid(Output)) {
         map.emplace(key, utils::underlying_value(parse<Output>(value)));
+    } else if (type == typeid(std::vector<Output>)) {
+        // The image formats accepted by the client, in order of preference
+        std::vector<int> outputs;
+        for (const auto &output : tokenize<Output>(value, ",", 2)) {
+            outputs.push_back(utils::underlying_value(output));
+        }
+
+        map.emplace(key, outputs);
+    } else if (type == typeid(WebpPreset)) {
+        map.emplace(key, utils::underlying_value(parse<WebpPreset>(value)));
     } else if (type == typeid(Canvas)) {
         // Deprecated without enlargement parameters
         if (value == "fit" || value == "squaredown") {
@@ -0,0 +1,43 @@
+#include "processors/adjustment.h"
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+VImage Adjustment::process(const VImage &image) const {
+    auto brightness = Brightness(query_);
+    auto contrast = Contrast(query_);
+    auto gamma = Gamma(query_);
+
+    // Only 8-bit images can be mapped through an (8-bit) LUT
+    if (image.format() != VIPS_FORMAT_UCHAR) {
+        return image | brightness | contrast | gamma;
+    }
+
+    // These adjustments are per-channel, so running them on an identity LUT
+    // gives us a single LUT with all adjustments combined
+    auto identity = VImage::identity();
+    auto lut = identity | brightness | contrast | gamma;
+
+    // Should we process the image?
+    // Note: the processors return their input untouched when there's nothing
+    // to do.
+    if (lut.get_image() == identity.get_image()) {
+        return image;
+    }
+
+    // Map the image through the combined LUT in one pass
+    if (image.has_alpha()) {
+        // Separate alpha channel
+        auto image_without_alpha = image.extract_band(
+            0, VImage::option()->set("n", image.bands() - 1));
+        auto alpha = image[image.bands() - 1];
+        return image_without_alpha.maplut(lut).bandjoin(alpha);
+    } else {
+        return image.maplut(lut);
+    }
+}
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
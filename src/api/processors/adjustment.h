@@ -0,0 +1,26 @@
+#pragma once
+
+#include "processors/base.h"
+#include "processors/brightness.h"
+#include "processors/contrast.h"
+#include "processors/gamma.h"
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+/**
+ * Combines the per-channel colour adjustments (brightness, contrast and
+ * gamma) into a single stage. 8-bit images are mapped through one LUT,
+ * any other image runs through the adjustments one by one.
+ */
+class Adjustment : ImageProcessor {
+ public:
+    using ImageProcessor::ImageProcessor;
+
+    VImage process(const VImage &image) const override;
+};
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
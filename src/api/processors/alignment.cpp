@@ -1,5 +1,9 @@
 #include "processors/alignment.h"
 
+#include "processors/crop.h"
+#include "processors/orientation.h"
+#include "processors/trim.h"
+
 namespace weserv {
 namespace api {
 namespace processors {
@@ -7,6 +11,137 @@ namespace processors {
 using enums::Canvas;
 using enums::Position;
 
+using io::Source;
+
+// The interesting area is found on a proxy of at most 256x256 pixels per
+// frame, which is plenty for the entropy and attention strategies of
+// smartcrop
+const int PROXY_SIZE = 256;
+
+VImage Alignment::new_proxy(const VImage &image, const Source &source) const {
+    auto proxy = new_page_thumbnail(query_, source, PROXY_SIZE, PROXY_SIZE);
+
+    // Trim and orient the proxy in the same way as the image, these
+    // processors don't depend on the resolution of the image
+    proxy = proxy | Trim(query_) | Orientation(query_);
+
+    if (query_->get<bool>("precrop", false)) {
+        bool trim = query_->get<bool>("trim", false);
+        int width = trim ? query_->get<int>("trim_width") : image.width();
+        int height = trim ? query_->get<int>("trim_height") : image.height();
+
+        // Multi-page images are never rotated
+        auto angle = query_->get<int>("angle", 0);
+        if ((angle == 90 || angle == 270) && query_->get<int>("n", 1) == 1) {
+            std::swap(width, height);
+        }
+
+        // The crop area is relative to the full-size image, scale it down to
+        // the proxy
+        int left, top, crop_width, crop_height;
+        std::tie(left, top, crop_width, crop_height) =
+            Crop(query_).resolve_area(width, height);
+
+        double hscale = static_cast<double>(proxy.width()) /
+                        static_cast<double>(width);
+        double vscale = static_cast<double>(proxy.height()) /
+                        static_cast<double>(height);
+
+        int proxy_left = std::min(proxy.width() - 1,
+                                  static_cast<int>(std::floor(left * hscale)));
+        int proxy_top = std::min(proxy.height() - 1,
+                                 static_cast<int>(std::floor(top * vscale)));
+        int proxy_width = std::min(
+            proxy.width() - proxy_left,
+            static_cast<int>(std::ceil(crop_width * hscale)));
+        int proxy_height = std::min(
+            proxy.height() - proxy_top,
+            static_cast<int>(std::ceil(crop_height * vscale)));
+
+        proxy = proxy.extract_area(proxy_left, proxy_top,
+                                   std::max(1, proxy_width),
+                                   std::max(1, proxy_height));
+    }
+
+    // The proxy is tiny and will be read a couple of times
+    return proxy.copy_memory();
+}
+
+std::pair<int, int> Alignment::find_interest(const VImage &frame,
+                                             const int width,
+                                             const int height) const {
+    auto crop_position = query_->get<Position>("a", Position::Center);
+
+    auto window = frame.smartcrop(
+        width, height,
+        VImage::option()->set("interesting",
+                              utils::underlying_value(crop_position)));
+
+    // The window is extracted from the frame, which is recorded as a
+    // negative offset
+    int left = -window.xoffset();
+    int top = -window.yoffset();
+
+    return std::make_pair(left + width / 2, top + height / 2);
+}
+
+void Alignment::resolve_interest(const VImage &image,
+                                 const Source &source) const {
+    auto crop_position = query_->get<Position>("a", Position::Center);
+
+    // Only needed for smart crops
+    if (query_->get<Canvas>("fit", Canvas::Max) != Canvas::Crop ||
+        (crop_position != Position::Entropy &&
+         crop_position != Position::Attention)) {
+        return;
+    }
+
+    auto proxy = new_proxy(image, source);
+
+    auto n_pages = query_->get<int>("n", 1);
+    int proxy_width = proxy.width();
+    int page_height = proxy.height() / n_pages;
+
+    // The image will be resized to cover the requested dimensions, so the
+    // window has the same aspect ratio as these dimensions
+    auto width = query_->get<int>("w", 0);
+    auto height = query_->get<int>("h", 0);
+
+    int window_width = proxy_width;
+    int window_height = page_height;
+    if (width > 0 && height > 0) {
+        double aspect =
+            static_cast<double>(width) / static_cast<double>(height);
+        if (proxy_width > page_height * aspect) {
+            window_width = std::max(
+                1, static_cast<int>(std::rint(page_height * aspect)));
+        } else {
+            window_height = std::max(
+                1, static_cast<int>(std::rint(proxy_width / aspect)));
+        }
+    }
+
+    // Each frame gets its own window
+    std::vector<int> interest_x;
+    std::vector<int> interest_y;
+    for (int i = 0; i < n_pages; ++i) {
+        auto frame =
+            proxy.extract_area(0, i * page_height, proxy_width, page_height);
+
+        int x, y;
+        std::tie(x, y) = find_interest(frame, window_width, window_height);
+
+        interest_x.push_back(x);
+        interest_y.push_back(y);
+    }
+
+    // Store the centres relative to the proxy
+    query_->update("interest_x", interest_x);
+    query_->update("interest_y", interest_y);
+    query_->update("interest_ref_width", proxy_width);
+    query_->update("interest_ref_height", page_height);
+}
+
 VImage Alignment::process(const VImage &image) const {
     // Should we process the image?
     if (query_->get<Canvas>("fit", Canvas::Max) != Canvas::Crop) {
@@ -42,37 +177,76 @@ VImage Alignment::process(const VImage &image) const {
 
     auto n_pages = query_->get<int>("n", 1);
 
-    // Skip smart crop for multi-page images
-    if (n_pages == 1 && (crop_position == Position::Entropy ||
-                         crop_position == Position::Attention)) {
-        // Need to copy to memory, we have to stay seq
-        return image.copy_memory().smartcrop(
-            min_width, min_height,
-            VImage::option()->set("interesting",
-                                  utils::underlying_value(crop_position)));
-    } else {
-        int left;
-        int top;
-        if (crop_position == Position::Focal) {
-            left = static_cast<int>(
-                std::round((image_width - width) *
-                           (query_->get<int>("focal_x", 50) / 100.0)));
-            top = static_cast<int>(
-                std::round((image_height - height) *
-                           (query_->get<int>("focal_y", 50) / 100.0)));
-        } else {
-            std::tie(left, top) = utils::calculate_position(
-                width, height, image_width, image_height, crop_position);
+    if ((crop_position == Position::Entropy ||
+         crop_position == Position::Attention) &&
+        query_->exists("interest_x")) {
+        auto interest_x = query_->get<std::vector<int>>("interest_x");
+        auto interest_y = query_->get<std::vector<int>>("interest_y");
+        n_pages = std::min(n_pages, static_cast<int>(interest_x.size()));
+
+        int page_height = n_pages > 1
+                              ? query_->get<int>("page_height", image_height)
+                              : image_height;
+        auto frame_height = query_->get_if<int>(
+            "h",
+            [&page_height](int h) {
+                // Limit height to page boundary
+                return h > 0 && h < page_height;
+            },
+            page_height);
+
+        // The window centres are relative to the proxy
+        double hscale = static_cast<double>(image_width) /
+                        query_->get<int>("interest_ref_width");
+        double vscale = static_cast<double>(page_height) /
+                        query_->get<int>("interest_ref_height");
+
+        std::vector<VImage> frames;
+        frames.reserve(n_pages);
+        for (int i = 0; i < n_pages; ++i) {
+            int left = static_cast<int>(std::rint(interest_x[i] * hscale)) -
+                       min_width / 2;
+            int top = static_cast<int>(std::rint(interest_y[i] * vscale)) -
+                      frame_height / 2;
+
+            left = std::max(0, std::min(left, image_width - min_width));
+            top = std::max(0, std::min(top, page_height - frame_height));
+
+            frames.push_back(image.extract_area(left, i * page_height + top,
+                                                min_width, frame_height));
         }
 
-        // Leave the height unchanged in toilet-roll mode
-        if (n_pages > 1) {
-            top = 0;
-            min_height = image_height;
+        if (n_pages == 1) {
+            return frames[0];
         }
 
-        return image.extract_area(left, top, min_width, min_height);
+        // Each frame is cropped individually, update the page height
+        query_->update("page_height", frame_height);
+
+        return VImage::arrayjoin(frames, VImage::option()->set("across", 1));
     }
+
+    int left;
+    int top;
+    if (crop_position == Position::Focal) {
+        left = static_cast<int>(
+            std::round((image_width - width) *
+                       (query_->get<int>("focal_x", 50) / 100.0)));
+        top = static_cast<int>(
+            std::round((image_height - height) *
+                       (query_->get<int>("focal_y", 50) / 100.0)));
+    } else {
+        std::tie(left, top) = utils::calculate_position(
+            width, height, image_width, image_height, crop_position);
+    }
+
+    // Leave the height unchanged in toilet-roll mode
+    if (n_pages > 1) {
+        top = 0;
+        min_height = image_height;
+    }
+
+    return image.extract_area(left, top, min_width, min_height);
 }
 
 }  // namespace processors
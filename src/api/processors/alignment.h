@@ -1,8 +1,12 @@
 #pragma once
 
+#include "io/source.h"
 #include "processors/base.h"
 
 #include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace weserv {
 namespace api {
@@ -12,7 +16,37 @@ class Alignment : ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
+    /**
+     * Find the most interesting area of each frame on a small proxy of the
+     * source and store it in the query map. This is only needed for smart
+     * crops, the actual crop is done within `process`.
+     * @param image The source image.
+     * @param source Source to read from.
+     */
+    void resolve_interest(const VImage &image, const io::Source &source) const;
+
     VImage process(const VImage &image) const override;
+
+ private:
+    /**
+     * Load a small proxy of the source, which matches the (oriented, trimmed
+     * and pre-cropped) image seen by `process`.
+     * @param image The source image.
+     * @param source Source to read from.
+     * @return The proxy image.
+     */
+    VImage new_proxy(const VImage &image, const io::Source &source) const;
+
+    /**
+     * Find the centre of the most interesting window within a frame, using
+     * the smartcrop strategy of the query.
+     * @param frame The frame to search.
+     * @param width Width of the window.
+     * @param height Height of the window.
+     * @return The centre of the window as a pair of x and y coordinates.
+     */
+    std::pair<int, int> find_interest(const VImage &frame, int width,
+                                      int height) const;
 };
 
 }  // namespace processors
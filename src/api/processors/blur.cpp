@@ -4,6 +4,16 @@ namespace weserv {
 namespace api {
 namespace processors {
 
+// Mask of the fast, mild blur
+// clang-format off
+const std::array<double, 9> MILD_BLUR_MASK = {
+    1.0, 1.0, 1.0,
+    1.0, 1.0, 1.0,
+    1.0, 1.0, 1.0
+};
+// clang-format on
+const double MILD_BLUR_SCALE = 9.0;
+
 VImage Blur::process(const VImage &image) const {
     auto sigma = query_->get<float>("blur", 0.0F);
 
@@ -20,13 +30,10 @@ VImage Blur::process(const VImage &image) const {
 
     if (sigma == -1.0F) {
         // Fast, mild blur - averages neighbouring pixels
-        // clang-format off
-        VImage blur = VImage::new_matrixv(3, 3,
-                                          1.0, 1.0, 1.0,
-                                          1.0, 1.0, 1.0,
-                                          1.0, 1.0, 1.0);
-        // clang-format on
-        blur.set("scale", 9.0);
+        // Takes a copy of the mask
+        auto blur = VImage::new_matrix(
+            3, 3, const_cast<double *>(MILD_BLUR_MASK.data()), 9);
+        blur.set("scale", MILD_BLUR_SCALE);
         return image.conv(blur);
     } else {
         // Slower, accurate Gaussian blur
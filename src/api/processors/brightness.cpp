@@ -22,15 +22,20 @@ VImage Brightness::process(const VImage &image) const {
     // Map brightness from -100/100 to -255/255 range
     double brightness = bri * 2.55;
 
+    // Keep 8-bit images in the integer domain
+    auto options = VImage::option()->set(
+        "uchar", image.format() == VIPS_FORMAT_UCHAR);
+
     // Edit the brightness
     if (image.has_alpha()) {
         // Separate alpha channel
         auto image_without_alpha = image.extract_band(
             0, VImage::option()->set("n", image.bands() - 1));
         auto alpha = image[image.bands() - 1];
-        return image_without_alpha.linear(1, brightness).bandjoin(alpha);
+        return image_without_alpha.linear(1, brightness, options)
+            .bandjoin(alpha);
     } else {
-        return image.linear(1, brightness);
+        return image.linear(1, brightness, options);
     }
 
     /*VipsInterpretation old_interpretation = image.interpretation();
@@ -4,16 +4,8 @@ namespace weserv {
 namespace api {
 namespace processors {
 
-VImage Crop::process(const VImage &image) const {
-    // Should we process the image?
-    if (!query_->exists("cx") && !query_->exists("cy") &&
-        !query_->exists("cw") && !query_->exists("ch")) {
-        return image;
-    }
-
-    int image_width = image.width();
-    int image_height = image.height();
-
+std::tuple<int, int, int, int>
+Crop::resolve_area(const int image_width, const int image_height) const {
     auto crop_x = query_->get_if<int>(
         "cx",
         [&image_width](int x) {
@@ -54,7 +46,21 @@ VImage Crop::process(const VImage &image) const {
         crop_h = image_height;
     }
 
-    return image.extract_area(crop_x, crop_y, crop_w, crop_h);
+    return std::make_tuple(crop_x, crop_y, crop_w, crop_h);
+}
+
+VImage Crop::process(const VImage &image) const {
+    // Should we process the image?
+    if (!query_->exists("cx") && !query_->exists("cy") &&
+        !query_->exists("cw") && !query_->exists("ch")) {
+        return image;
+    }
+
+    int left, top, width, height;
+    std::tie(left, top, width, height) =
+        resolve_area(image.width(), image.height());
+
+    return image.extract_area(left, top, width, height);
 }
 
 }  // namespace processors
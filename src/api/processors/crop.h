@@ -2,6 +2,8 @@
 
 #include "processors/base.h"
 
+#include <tuple>
+
 namespace weserv {
 namespace api {
 namespace processors {
@@ -10,6 +12,15 @@ class Crop : ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
+    /**
+     * Resolve the crop area for an image with the given dimensions.
+     * @param image_width Width of the image.
+     * @param image_height Height of the image.
+     * @return The left, top, width and height of the crop area.
+     */
+    std::tuple<int, int, int, int> resolve_area(int image_width,
+                                                int image_height) const;
+
     VImage process(const VImage &image) const override;
 };
 
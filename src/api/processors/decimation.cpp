@@ -0,0 +1,237 @@
+#include "processors/decimation.h"
+
+#include "processors/trim.h"
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+using io::Source;
+
+// Identical frames are found on a preview of (at most) 64x64 pixels per
+// frame
+const int PREVIEW_SIZE = 64;
+
+std::vector<int> Decimation::resolve_delays(const VImage &image,
+                                            const int n_pages) const {
+    std::vector<int> delays;
+
+#if VIPS_VERSION_AT_LEAST(8, 9, 0)
+    if (query_->exists("delay")) {
+        delays = query_->get<std::vector<int>>("delay");
+    } else if (image.get_typeof("delay") != 0) {
+        delays = image.get_array_int("delay");
+    }
+
+    if (delays.size() == 1) {
+        // Just one delay, repeat that value for all frames
+        delays.insert(delays.end(), n_pages - 1, delays[0]);
+    }
+
+    // Not an animation, or we don't know the delay of each frame
+    if (static_cast<int>(delays.size()) < n_pages) {
+        return {};
+    }
+
+    delays.resize(n_pages);
+
+    for (auto &delay : delays) {
+        delay = std::max(0, delay);
+    }
+#endif
+
+    return delays;
+}
+
+VImage Decimation::join_frames(const VImage &image, const int page_height,
+                               const std::vector<int> &frames,
+                               const std::vector<int> &delays) const {
+    std::vector<VImage> pages;
+    pages.reserve(frames.size());
+
+    for (const auto &frame : frames) {
+        pages.push_back(image.extract_area(0, frame * page_height,
+                                           image.width(), page_height));
+    }
+
+    // The interesting areas (for smart crops) were found on all frames
+    if (query_->exists("interest_x")) {
+        auto interest_x = query_->get<std::vector<int>>("interest_x");
+        auto interest_y = query_->get<std::vector<int>>("interest_y");
+
+        std::vector<int> x, y;
+        for (const auto &frame : frames) {
+            if (frame < static_cast<int>(interest_x.size())) {
+                x.push_back(interest_x[frame]);
+                y.push_back(interest_y[frame]);
+            }
+        }
+
+        query_->update("interest_x", x);
+        query_->update("interest_y", y);
+    }
+
+    auto n_pages = static_cast<int>(frames.size());
+
+    query_->update("n", n_pages);
+    query_->update("delay", delays);
+
+    // Attaching metadata, need to copy the image
+    auto copy = VImage::arrayjoin(pages, VImage::option()->set("across", 1))
+                    .copy();
+    copy.set(VIPS_META_N_PAGES, n_pages);
+
+    return copy;
+}
+
+void Decimation::resolve_duplicates(const VImage &image,
+                                    const Source &source) const {
+    auto n_pages = query_->get<int>("n", 1);
+    int page_height = utils::get_page_height(image);
+
+    // Should we process the image?
+    if (n_pages <= 1 || page_height * n_pages != image.height() ||
+        resolve_delays(image, n_pages).empty()) {
+        return;
+    }
+
+    // Compare the frames of a small preview, decoded separately from the
+    // (sequential) source image, with the previous one. Frames that differ
+    // only in details that vanish in the preview are merged as well.
+    auto frames = new_page_thumbnail(query_, source,
+                                     std::min(image.width(), PREVIEW_SIZE),
+                                     std::min(page_height, PREVIEW_SIZE));
+    int preview_height = utils::get_page_height(frames);
+    if (frames.height() != preview_height * n_pages) {
+        return;  // LCOV_EXCL_LINE
+    }
+
+    // The preview is small, keep all of it in memory
+    frames = frames.copy_memory();
+
+    auto *data = static_cast<const uint8_t *>(frames.data());
+    size_t frame_size =
+        VIPS_IMAGE_SIZEOF_LINE(frames.get_image()) * preview_height;
+
+    std::vector<int> unique_frames = {0};
+    const uint8_t *previous = data;
+
+    for (int i = 1; i < n_pages; ++i) {
+        const uint8_t *frame = data + i * frame_size;
+
+        if (std::memcmp(frame, previous, frame_size) != 0) {
+            unique_frames.push_back(i);
+            previous = frame;
+        }
+    }
+
+    // Only merge frames if there's a run of identical frames
+    if (static_cast<int>(unique_frames.size()) < n_pages) {
+        query_->update("unique_frames", unique_frames);
+    }
+}
+
+VImage Decimation::process(const VImage &image) const {
+    auto n_pages = query_->get<int>("n", 1);
+    auto fps = query_->get_if<float>(
+        "fps",
+        [](float f) {
+            // Frame rate needs to be in the range of
+            // 0.1 - 100
+            return f >= 0.1 && f <= 100;
+        },
+        0.0F);
+    auto max_frames = query_->get_if<int>(
+        "maxframes",
+        [](int m) {
+            // Maximum number of frames needs to be in
+            // the range of 1 - 256
+            return m >= 1 && m <= 256;
+        },
+        0);
+
+    bool merge = query_->exists("unique_frames");
+
+    // Should we process the image?
+    if (n_pages <= 1 || (fps == 0.0F && max_frames == 0 && !merge)) {
+        return image;
+    }
+
+    int page_height = utils::get_page_height(image);
+    if (page_height * n_pages != image.height()) {
+        return image;
+    }
+
+    auto delays = resolve_delays(image, n_pages);
+    if (delays.empty()) {
+        return image;
+    }
+
+    // Runs of identical frames are merged into their first frame, see
+    // resolve_duplicates()
+    std::vector<int> candidates;
+    if (merge) {
+        candidates = query_->get<std::vector<int>>("unique_frames");
+    } else {
+        candidates.resize(n_pages);
+        std::iota(candidates.begin(), candidates.end(), 0);
+    }
+
+    // Each frame that is kept shows until the next one
+    auto accumulate_delays = [&delays, n_pages](const std::vector<int> &kept) {
+        std::vector<int> kept_delays;
+        kept_delays.reserve(kept.size());
+
+        for (size_t i = 0; i != kept.size(); ++i) {
+            int end = i + 1 < kept.size() ? kept[i + 1] : n_pages;
+
+            int delay = 0;
+            for (int j = kept[i]; j < end; ++j) {
+                delay += delays[j];
+            }
+            kept_delays.push_back(delay);
+        }
+
+        return kept_delays;
+    };
+
+    auto candidate_delays = accumulate_delays(candidates);
+
+    // Drop the frames that follow the previous frame too fast
+    double interval = fps > 0 ? 1000.0 / fps : 0.0;
+    double next_time = 0.0;
+    int time = 0;
+
+    std::vector<int> frames;
+    for (size_t i = 0; i != candidates.size(); ++i) {
+        if (time >= next_time) {
+            frames.push_back(candidates[i]);
+            next_time = time + interval;
+        }
+        time += candidate_delays[i];
+    }
+
+    // Spread the maximum number of frames evenly over the animation
+    if (max_frames > 0 && static_cast<int>(frames.size()) > max_frames) {
+        double step = static_cast<double>(frames.size()) / max_frames;
+
+        std::vector<int> selection;
+        selection.reserve(max_frames);
+        for (int i = 0; i < max_frames; ++i) {
+            selection.push_back(frames[static_cast<size_t>(i * step)]);
+        }
+
+        frames.swap(selection);
+    }
+
+    if (static_cast<int>(frames.size()) == n_pages) {
+        return image;
+    }
+
+    return join_frames(image, page_height, frames,
+                       accumulate_delays(frames));
+}
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
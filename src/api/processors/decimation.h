@@ -0,0 +1,66 @@
+#pragma once
+
+#include "io/source.h"
+#include "processors/base.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+class Decimation : ImageProcessor {
+ public:
+    using ImageProcessor::ImageProcessor;
+
+    /**
+     * Find runs of identical frames of an animation on a small preview and
+     * store the frames that differ from their predecessor in the query map
+     * (only if there is such a run). The preview is decoded separately from
+     * the source, so this doesn't touch the (sequential) source image.
+     * @param image The source image.
+     * @param source Source to read from.
+     */
+    void resolve_duplicates(const VImage &image,
+                            const io::Source &source) const;
+
+    /**
+     * Merge runs of identical frames of an animation (see
+     * `resolve_duplicates`), and drop frames to honor the maximum frame rate
+     * (`&fps=`) and the maximum number of frames (`&maxframes=`). The delays
+     * of the merged and dropped frames are accumulated into the frame before
+     * them.
+     */
+    VImage process(const VImage &image) const override;
+
+ private:
+    /**
+     * Resolve the delay of each frame, in milliseconds. A delay given in the
+     * query takes precedence over the delays stored in the image.
+     * @param image The (multi-page) image.
+     * @param n_pages The number of pages in the image.
+     * @return The delays or an empty vector if the image isn't animated.
+     */
+    std::vector<int> resolve_delays(const VImage &image, int n_pages) const;
+
+    /**
+     * Join the given frames and update the query map accordingly.
+     * @param image The (multi-page) image.
+     * @param page_height The height of a single frame.
+     * @param frames The frames to keep.
+     * @param delays The delays of the frames to keep.
+     * @return A new image.
+     */
+    VImage join_frames(const VImage &image, int page_height,
+                       const std::vector<int> &frames,
+                       const std::vector<int> &delays) const;
+};
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
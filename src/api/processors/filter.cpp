@@ -7,6 +7,26 @@ namespace processors {
 using enums::FilterType;
 using parsers::Color;
 
+ColourTransform Filter::resolve_transform() const {
+    auto filter_type = query_->get<FilterType>("filt", FilterType::None);
+
+    switch (filter_type) {
+        case FilterType::Sepia:
+            // clang-format off
+            return {{0.3588, 0.7044, 0.1368,
+                     0.2990, 0.5870, 0.1140,
+                     0.2392, 0.4696, 0.0912},
+                    {0.0, 0.0, 0.0}};
+            // clang-format on
+        case FilterType::Negate:
+            return {{-1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, -1.0},
+                    {255.0, 255.0, 255.0}};
+        default:
+            return {{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0},
+                    {0.0, 0.0, 0.0}};
+    }
+}
+
 VImage Filter::process(const VImage &image) const {
     auto filter_type = query_->get<FilterType>("filt", FilterType::None);
 
@@ -19,30 +39,9 @@ VImage Filter::process(const VImage &image) const {
         case FilterType::Greyscale:
             // Perform greyscale filter manipulation
             return image.colourspace(VIPS_INTERPRETATION_B_W);
-        case FilterType::Sepia: {
+        case FilterType::Sepia:
             // Perform sepia filter manipulation
-            // clang-format off
-            std::array<double, 9> sepia = {
-                0.3588, 0.7044, 0.1368,
-                0.2990, 0.5870, 0.1140,
-                0.2392, 0.4696, 0.0912
-            };
-
-            auto matrix =
-                image.bands() == 3
-                    ? VImage::new_from_memory(sepia.begin(), 9 * sizeof(double),
-                                              3, 3, 1, VIPS_FORMAT_DOUBLE)
-                    : VImage::new_matrixv(4, 4,
-                                          sepia[0], sepia[1], sepia[2], 0.0,
-                                          sepia[3], sepia[4], sepia[5], 0.0,
-                                          sepia[6], sepia[7], sepia[8], 0.0,
-                                          0.0, 0.0, 0.0, 1.0);
-
-            return image
-                .colourspace(VIPS_INTERPRETATION_sRGB)
-                .recomb(matrix);
-            // clang-format on
-        }
+            return resolve_transform().apply(image);
         case FilterType::Duotone: {
             // #C83658 by default
             std::vector<double> start =
@@ -52,15 +51,20 @@ VImage Filter::process(const VImage &image) const {
             std::vector<double> stop =
                 query_->get<Color>("stop", Color(255, 216, 231, 79)).to_lab();
 
+            std::vector<double> params(start);
+            params.insert(params.end(), stop.begin(), stop.end());
+
             // Perform duotone filter manipulation
-            auto lut = VImage::identity() / 255;
+            auto lut = utils::cached_image("maplut", params, [&]() {
+                auto identity = VImage::identity() / 255;
 
-            // Makes a lut which is a smooth gradient from start colour to stop
-            // colour, with start and stop in CIELAB
-            lut = lut * stop + (1 - lut) * start;
-            lut = lut.colourspace(
-                VIPS_INTERPRETATION_sRGB,
-                VImage::option()->set("source_space", VIPS_INTERPRETATION_LAB));
+                // Makes a lut which is a smooth gradient from start colour to
+                // stop colour, with start and stop in CIELAB
+                return (identity * stop + (1 - identity) * start)
+                    .colourspace(VIPS_INTERPRETATION_sRGB,
+                                 VImage::option()->set(
+                                     "source_space", VIPS_INTERPRETATION_LAB));
+            });
 
             // The first step to implement a duotone filter is to convert the
             // image to greyscale. The image is then mapped through the lut.
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "processors/base.h"
+#include "processors/recombination.h"
+#include "utils/cache.h"
 
 namespace weserv {
 namespace api {
@@ -10,6 +12,13 @@ class Filter : ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
+    /**
+     * The sepia or negate filter as a colour transform, so that it can be
+     * combined with the saturation (see `Recombination`).
+     * @return The colour transform, the identity for other filters.
+     */
+    ColourTransform resolve_transform() const;
+
     VImage process(const VImage &image) const override;
 };
 
@@ -7,10 +7,41 @@ namespace processors {
 using enums::MaskType;
 using parsers::Color;
 
-std::string Mask::svg_path_by_type(const int width, const int height,
-                                   const MaskType &mask,
-                                   int *out_x_min, int *out_y_min,
-                                   int *out_width, int *out_height) const {
+// Number of samples per pixel row, the horizontal coverage is exact
+const int SUBSAMPLES = 16;
+
+// Maximum number of masks kept per worker
+const size_t MAX_CACHED_MASKS = 16;
+
+// Masks larger than this (= 4 megapixels) are not cached
+const int MAX_CACHED_MASK_SIZE = 4000000;
+
+// Maximum memory used by the cached masks per worker (= 16 MiB)
+const size_t MAX_MASK_CACHE_MEMORY = 16 * 1024 * 1024;
+
+struct CachedMask {
+    MaskType type;
+    int width;
+    int height;
+
+    // Dimensions of the path within the mask, used for trimming
+    int mask_width;
+    int mask_height;
+
+    VImage mask;
+    size_t memory;
+};
+
+// Rasterized masks, most recently used first
+thread_local std::list<CachedMask> mask_cache;
+
+// Memory used by the cached masks, in bytes
+thread_local size_t mask_cache_memory = 0;
+
+std::vector<Mask::PathCoordinate>
+Mask::path_by_type(const int width, const int height, const MaskType &mask,
+                   int *out_x_min, int *out_y_min, int *out_width,
+                   int *out_height) const {
     int min = std::min(width, height);
     float outer_radius = static_cast<float>(min) / 2.0F;
     float mid_x = static_cast<float>(width) / 2.0F;
@@ -26,7 +57,7 @@ std::string Mask::svg_path_by_type(const int width, const int height,
         std::tie(mask_transl, scale) = translation_and_scaling(
             width, height, *out_x_min, *out_y_min, out_width, out_height);
 
-        return transformed_path_string(coordinates, mask_transl, scale);
+        return transformed_path(coordinates, mask_transl, scale);
     }
 
     if (mask == MaskType::Ellipse) {
@@ -35,7 +66,7 @@ std::string Mask::svg_path_by_type(const int width, const int height,
         *out_width = width;
         *out_height = height;
 
-        return svg_ellipse_path(mid_x, mid_y, mid_x, mid_y);
+        return ellipse_path(mid_x, mid_y, mid_x, mid_y);
     }
 
     if (mask == MaskType::Circle) {
@@ -44,7 +75,7 @@ std::string Mask::svg_path_by_type(const int width, const int height,
         *out_width = min;
         *out_height = min;
 
-        return svg_circle_path(mid_x, mid_y, outer_radius);
+        return ellipse_path(mid_x, mid_y, outer_radius, outer_radius);
     }
 
     // 'inner' radius of the polygon/star
@@ -137,33 +168,30 @@ std::string Mask::svg_path_by_type(const int width, const int height,
     std::tie(mask_transl, scale) = translation_and_scaling(
         width, height, *out_x_min, *out_y_min, out_width, out_height);
 
-    std::string path = transformed_path_string(coordinates, mask_transl, scale);
+    return transformed_path(coordinates, mask_transl, scale);
+}
+
+std::vector<Mask::PathCoordinate> Mask::ellipse_path(const float cx,
+                                                     const float cy,
+                                                     const float rx,
+                                                     const float ry) const {
+    // Segments of (at most) 4 pixels deviate less than 2 / r pixels from the
+    // curve
+    auto segments = std::max(
+        64, static_cast<int>(std::ceil(2 * M_PI * std::max(rx, ry) / 4.0)));
 
-    // If an odd number of points, add an additional point at the top of the
-    // polygon this will shift the calculated center point of the shape so that
-    // the center point of the polygon is at x,y (otherwise the center is
-    // mis-located)
-    if (points % 2 == 1) {
-        path = "M0 " + std::to_string(outer_radius) + " " + path;
-    }
+    std::vector<PathCoordinate> coordinates;
+    coordinates.reserve(segments);
 
-    return path;
-}
+    for (int i = 0; i < segments; ++i) {
+        double angle = i * 2 * M_PI / segments;
 
-std::string Mask::svg_circle_path(const float cx, const float cy,
-                                  const float r) const {
-    std::ostringstream ss;
-    ss << "M " << cx - r << ", " << cy << "a" << r << "," << r << " 0 1,0 "
-       << r * 2 << ",0 a " << r << "," << r << " 0 1,0 -" << r * 2 << ",0";
-    return ss.str();
-}
+        coordinates.push_back(
+            {static_cast<float>(cx + rx * std::cos(angle)),
+             static_cast<float>(cy + ry * std::sin(angle))});
+    }
 
-std::string Mask::svg_ellipse_path(const float cx, const float cy,
-                                   const float rx, const float ry) const {
-    std::ostringstream ss;
-    ss << "M " << cx - rx << ", " << cy << "a" << rx << "," << ry << " 0 1,0 "
-       << rx * 2 << ",0a" << rx << "," << ry << " 0 1,0 -" << rx * 2 << ",0";
-    return ss.str();
+    return coordinates;
 }
 
 std::vector<Mask::PathCoordinate>
@@ -251,24 +279,145 @@ Mask::translation_and_scaling(const int image_width, const int image_height,
     return std::make_pair(mask_transl, scale);
 }
 
-std::string
-Mask::transformed_path_string(const std::vector<PathCoordinate> &coordinates,
-                              const PathCoordinate &transl,
-                              const double scale) const {
-    std::ostringstream ss;
-    ss << std::fixed << std::showpoint << std::setprecision(1);
+std::vector<Mask::PathCoordinate>
+Mask::transformed_path(const std::vector<PathCoordinate> &coordinates,
+                       const PathCoordinate &transl,
+                       const double scale) const {
+    std::vector<PathCoordinate> transformed;
+    transformed.reserve(coordinates.size());
+
+    for (const auto &coordinate : coordinates) {
+        transformed.push_back(
+            {static_cast<float>(coordinate.x * scale + transl.x),
+             static_cast<float>(coordinate.y * scale + transl.y)});
+    }
+
+    return transformed;
+}
+
+VImage Mask::rasterize(const std::vector<PathCoordinate> &path,
+                       const int width, const int height) const {
+    VImage mask(vips_image_new_memory());
+    vips_image_init_fields(mask.get_image(), width, height, 1,
+                           VIPS_FORMAT_UCHAR, VIPS_CODING_NONE,
+                           VIPS_INTERPRETATION_B_W, 1.0, 1.0);
+    if (vips_image_write_prepare(mask.get_image()) != 0) {
+        throw vips::VError();  // LCOV_EXCL_LINE
+    }
 
-    for (size_t i = 0; i != coordinates.size(); ++i) {
-        PathCoordinate coordinate = coordinates[i];
+    struct Edge {
+        float top;
+        float bottom;
+        float x;      // x at the top of the edge
+        float slope;  // dx/dy
+    };
+
+    // The edge table, sorted by the top of the edges. Horizontal edges never
+    // cross a sample row.
+    std::vector<Edge> edges;
+    edges.reserve(path.size());
+    for (size_t i = 0, j = path.size() - 1; i < path.size(); j = i++) {
+        const auto &a = path[j];
+        const auto &b = path[i];
+        if (a.y == b.y) {
+            continue;
+        }
 
-        auto prepend = i == 0 ? "M" : " L";
-        ss << prepend << coordinate.x * scale + transl.x << " "
-           << coordinate.y * scale + transl.y;
+        const auto &top = a.y < b.y ? a : b;
+        const auto &bottom = a.y < b.y ? b : a;
+        edges.push_back({top.y, bottom.y, top.x,
+                         (bottom.x - top.x) / (bottom.y - top.y)});
     }
+    std::sort(edges.begin(), edges.end(),
+              [](const Edge &a, const Edge &b) { return a.top < b.top; });
+
+    // The edges that cross the current sample row
+    std::vector<const Edge *> active;
+    size_t next_edge = 0;
+
+    // Coverage of each pixel in the current row, summed over the samples.
+    // Pixels that are fully covered by a span are accumulated as a
+    // difference (`cover`), which is summed once per row. The extra element
+    // catches spans which end on the right edge.
+    std::vector<float> coverage(width + 1);
+    std::vector<float> cover(width + 1);
+    std::vector<VipsPel> line(width);
+    std::vector<float> crossings;
+
+    auto fill_span = [&coverage, &cover, width](float x0, float x1) {
+        x0 = std::max(0.0F, x0);
+        x1 = std::min(static_cast<float>(width), x1);
+        if (x0 >= x1) {
+            return;
+        }
+
+        auto first = static_cast<int>(x0);
+        auto last = static_cast<int>(x1);
+        if (first == last) {
+            coverage[first] += x1 - x0;
+            return;
+        }
+
+        coverage[first] += static_cast<float>(first + 1) - x0;
+        cover[first + 1] += 1.0F;
+        cover[last] -= 1.0F;
+        coverage[last] += x1 - static_cast<float>(last);
+    };
+
+    for (int y = 0; y < height; ++y) {
+        std::fill(coverage.begin(), coverage.end(), 0.0F);
+        std::fill(cover.begin(), cover.end(), 0.0F);
+
+        for (int s = 0; s < SUBSAMPLES; ++s) {
+            float sample_y =
+                static_cast<float>(y) + (static_cast<float>(s) + 0.5F) /
+                                            static_cast<float>(SUBSAMPLES);
+
+            // Activate the edges that start at or above this sample row, and
+            // retire the ones that end at or above it. Edges are half-open,
+            // so that a shared vertex is only counted once.
+            while (next_edge < edges.size() &&
+                   edges[next_edge].top <= sample_y) {
+                active.push_back(&edges[next_edge++]);
+            }
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [sample_y](const Edge *edge) {
+                                            return edge->bottom <= sample_y;
+                                        }),
+                         active.end());
+
+            if (active.empty()) {
+                continue;
+            }
+
+            // Find where the active edges cross this sample row
+            crossings.clear();
+            for (const auto *edge : active) {
+                crossings.push_back(edge->x +
+                                    (sample_y - edge->top) * edge->slope);
+            }
+
+            // Fill between pairs of crossings (even-odd rule)
+            std::sort(crossings.begin(), crossings.end());
+            for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+                fill_span(crossings[i], crossings[i + 1]);
+            }
+        }
+
+        float full = 0.0F;
+        for (int x = 0; x < width; ++x) {
+            full += cover[x];
+
+            float value = std::min(1.0F, (coverage[x] + full) / SUBSAMPLES);
+            line[x] = static_cast<VipsPel>(std::lround(value * 255.0F));
+        }
 
-    ss << " Z";
+        if (vips_image_write_line(mask.get_image(), y, line.data()) != 0) {
+            throw vips::VError();  // LCOV_EXCL_LINE
+        }
+    }
 
-    return ss.str();
+    return mask;
 }
 
 VImage Mask::process(const VImage &image) const {
@@ -283,13 +432,49 @@ VImage Mask::process(const VImage &image) const {
     int image_width = image.width();
     int image_height = image.height();
 
-    auto preserve_aspect_ratio =
-        mask_type == MaskType::Ellipse ? "none" : "xMidYMid meet";
-
-    int x_min, y_min, mask_width, mask_height;
-    auto path = svg_path_by_type(image_width, image_height, mask_type, &x_min,
+    // Look for a previously rasterized mask
+    auto it = std::find_if(mask_cache.begin(), mask_cache.end(),
+                           [&](const CachedMask &cached) {
+                               return cached.type == mask_type &&
+                                      cached.width == image_width &&
+                                      cached.height == image_height;
+                           });
+
+    VImage mask;
+    int mask_width;
+    int mask_height;
+    if (it != mask_cache.end()) {
+        mask = it->mask;
+        mask_width = it->mask_width;
+        mask_height = it->mask_height;
+
+        // Move to the front
+        mask_cache.splice(mask_cache.begin(), mask_cache, it);
+    } else {
+        int x_min, y_min;
+        auto path = path_by_type(image_width, image_height, mask_type, &x_min,
                                  &y_min, &mask_width, &mask_height);
 
+        mask = rasterize(path, image_width, image_height);
+
+        if (static_cast<int64_t>(image_width) * image_height <=
+            MAX_CACHED_MASK_SIZE) {
+            auto memory =
+                static_cast<size_t>(VIPS_IMAGE_SIZEOF_IMAGE(mask.get_image()));
+
+            mask_cache.push_front({mask_type, image_width, image_height,
+                                   mask_width, mask_height, mask, memory});
+            mask_cache_memory += memory;
+
+            // Evict the least recently used masks
+            while (mask_cache.size() > MAX_CACHED_MASKS ||
+                   mask_cache_memory > MAX_MASK_CACHE_MEMORY) {
+                mask_cache_memory -= mask_cache.back().memory;
+                mask_cache.pop_back();
+            }
+        }
+    }
+
     auto mask_background = query_->get<Color>("mbg", Color::DEFAULT);
     bool bg_has_alpha = mask_background.has_alpha_channel();
 
@@ -298,27 +483,19 @@ VImage Mask::process(const VImage &image) const {
 
     // Cutout first if the image or mask background has an alpha channel
     if (output_image.has_alpha() || bg_has_alpha) {
-        std::ostringstream svg;
-        svg << R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1")"
-            << " width=\"" << image_width << "\" height=\"" << image_height
-            << "\""
-            << " preserveAspectRatio=\"" << preserve_aspect_ratio << "\">\n"
-            << "<path d=\"" << path << "\"/>\n"
-            << "</svg>";
+        output_image = utils::ensure_alpha(output_image);
 
-        auto svg_mask = svg.str();
+        int alpha_band = output_image.bands() - 1;
 
-        auto mask = VImage::new_from_buffer(
-            svg_mask, "",
-            VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
+        // Cutout by multiplying the alpha channel with the mask
+        auto alpha = (output_image[alpha_band] * mask)
+                         .linear(1.0 / 255.0, 0.0)
+                         .cast(output_image.format());
 
-        // Ensure image to composite is premultiplied sRGB
-        mask = mask.premultiply();
-
-        // Cutout via dest-in
-        output_image = output_image.composite2(
-            mask, VIPS_BLEND_MODE_DEST_IN,
-            VImage::option()->set("premultiplied", true));
+        output_image =
+            output_image
+                .extract_band(0, VImage::option()->set("n", alpha_band))
+                .bandjoin(alpha);
 
         // The image now has an alpha channel
         query_->update("has_alpha", true);
@@ -326,30 +503,19 @@ VImage Mask::process(const VImage &image) const {
 
     // If the mask background is not completely transparent; overlay the frame
     if (!mask_background.is_transparent()) {
-        std::ostringstream svg;
-        svg << R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1")"
-            << " width=\"" << image_width << "\" height=\"" << image_height
-            << "\""
-            << " preserveAspectRatio=\"" << preserve_aspect_ratio << "\">\n"
-            << "<path d=\"" << path << " M0 0 h" << image_width << " v"
-            << image_height << " h-" << image_width
-            << R"( Z" fill-rule="evenodd" )"
-            << "fill=\"" << mask_background.to_string() << "\"/>\n"
-            << "</svg>";
-
-        auto svg_frame = svg.str();
-
-        auto frame = VImage::new_from_buffer(
-            svg_frame, "",
-            VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
-
-        // Ensure image to composite is premultiplied sRGB
-        frame = frame.premultiply();
+        auto rgba = mask_background.to_rgba();
+
+        // The frame is the mask background, outside of the mask
+        auto frame_alpha =
+            mask.invert().linear(rgba[3] / 255.0, 0.0).cast(VIPS_FORMAT_UCHAR);
+        auto frame =
+            mask.new_from_image({rgba[0], rgba[1], rgba[2]})
+                .bandjoin(frame_alpha)
+                .copy(VImage::option()->set("interpretation",
+                                            VIPS_INTERPRETATION_sRGB));
 
         // Alpha composite src over dst
-        output_image = output_image.composite2(
-            frame, VIPS_BLEND_MODE_OVER,
-            VImage::option()->set("premultiplied", true));
+        output_image = output_image.composite2(frame, VIPS_BLEND_MODE_OVER);
     }
 
     // Crop the image to the mask dimensions;
@@ -4,7 +4,9 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <limits>
+#include <list>
 #include <string>
 #include <utility>
 #include <vector>
@@ -25,7 +27,7 @@ class Mask : ImageProcessor {
 
  private:
     /**
-     * Get the SVG mask path by type.
+     * Get the mask path by type, in image coordinates.
      * @param width Image width.
      * @param height Image width.
      * @param mask Type mask.
@@ -33,17 +35,19 @@ class Mask : ImageProcessor {
      * @param out_y_min Top edge of mask.
      * @param out_width Mask width.
      * @param out_height Mask height.
+     * @return The mask represented as a closed polygon.
      */
-    std::string svg_path_by_type(int width, int height,
-                                 const enums::MaskType &mask,
-                                 int *out_x_min, int *out_y_min,
-                                 int *out_width, int *out_height) const;
+    std::vector<PathCoordinate> path_by_type(int width, int height,
+                                             const enums::MaskType &mask,
+                                             int *out_x_min, int *out_y_min,
+                                             int *out_width,
+                                             int *out_height) const;
 
     /**
      * Formula from http://mathworld.wolfram.com/HeartCurve.html
      * @param cx The x coordinate of the center of the image.
      * @param cy The y coordinate of the center of the image.
-     * @return The circle represented as SVG path.
+     * @return The heart represented as a closed polygon.
      */
     std::vector<PathCoordinate> heart_path(float cx, float cy,
                                            int *out_x_min, int *out_y_min,
@@ -66,35 +70,37 @@ class Mask : ImageProcessor {
                             int *mask_width, int *mask_height) const;
 
     /**
-     * Get the transformed path "d" attribute.
+     * Get the transformed path.
      * @param coordinates Path coordinates.
      * @param transl x, y-coordinate transformation.
      * @param scale Scale factor.
-     * @return Transformed path as string.
+     * @return Transformed path.
      */
-    std::string
-    transformed_path_string(const std::vector<PathCoordinate> &coordinates,
-                            const PathCoordinate &transl, double scale) const;
+    std::vector<PathCoordinate>
+    transformed_path(const std::vector<PathCoordinate> &coordinates,
+                     const PathCoordinate &transl, double scale) const;
 
     /**
-     * Generates an circle SVG path.
-     * See also: https://stackoverflow.com/a/10477334/1480019
-     * @param cx The x coordinate of the center of the circle.
-     * @param cy The y coordinate of the center of the circle.
-     * @param r The radius of the circle.
-     * @return The circle represented as SVG path.
-     */
-    std::string svg_circle_path(float cx, float cy, float r) const;
-
-    /**
-     * Generates an ellipse SVG path.
+     * Generates an ellipse path, with segments short enough to be
+     * indistinguishable from the curve.
      * @param cx The x coordinate of the center of the ellipse.
      * @param cy The y coordinate of the center of the ellipse.
      * @param rx The horizontal radius.
      * @param ry The vertical radius.
-     * @return The ellipse represented as SVG path.
+     * @return The ellipse represented as a closed polygon.
+     */
+    std::vector<PathCoordinate> ellipse_path(float cx, float cy, float rx,
+                                             float ry) const;
+
+    /**
+     * Rasterize a closed polygon to an anti-aliased, single-band mask.
+     * @param path The polygon.
+     * @param width Mask width.
+     * @param height Mask height.
+     * @return The mask as an 8-bit image, 255 is inside the polygon.
      */
-    std::string svg_ellipse_path(float cx, float cy, float rx, float ry) const;
+    VImage rasterize(const std::vector<PathCoordinate> &path, int width,
+                     int height) const;
 };
 
 }  // namespace processors
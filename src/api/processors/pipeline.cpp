@@ -0,0 +1,216 @@
+#include "processors/pipeline.h"
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+using enums::Canvas;
+using enums::FilterType;
+using enums::MaskType;
+using parsers::Color;
+
+void Pipeline::plan(const VImage &image) {
+    stages_.clear();
+    elided_.clear();
+
+    auto trim = Trim(query_);
+    auto thumbnail = Thumbnail(query_);
+    auto orientation = Orientation(query_);
+    auto alignment = Alignment(query_);
+    auto crop = Crop(query_);
+    auto decimation = Decimation(query_);
+    auto embed = Embed(query_);
+    auto rotation = Rotation(query_);
+    auto adjustment = Adjustment(query_);
+    auto sharpen = Sharpen(query_);
+    auto filter = Filter(query_);
+    auto blur = Blur(query_);
+    auto tint = Tint(query_);
+    auto background = Background(query_);
+    auto mask = Mask(query_);
+    auto saturate = Saturate(query_);
+    auto recombination = Recombination(query_);
+
+    // Note: these checks only look at the query and the image header, each
+    // processor still verifies whether it needs to do something.
+    auto n_pages = query_->get<int>("n", 1);
+    auto fit = query_->get<Canvas>("fit", Canvas::Max);
+
+    bool no_trim = !query_->get<bool>("trim", false);
+    bool no_orientation = query_->get<int>("angle", 0) == 0 &&
+                          !query_->get<bool>("flip", false) &&
+                          !query_->get<bool>("flop", false);
+    bool no_crop = !query_->exists("cx") && !query_->exists("cy") &&
+                   !query_->exists("cw") && !query_->exists("ch");
+    bool no_embed = fit != Canvas::Embed;
+    bool no_rotation = query_->get_if<int>(
+                           "ro", [](int r) { return r % 90 != 0; }, 0) == 0;
+    bool no_mask =
+        query_->get<MaskType>("mask", MaskType::None) == MaskType::None;
+    auto filter_type = query_->get<FilterType>("filt", FilterType::None);
+    bool no_blur = query_->get<float>("blur", 0.0F) == 0.0F;
+    bool no_tint = query_->get<Color>("tint", Color::DEFAULT).is_transparent();
+
+    // The background is only applied on images with an alpha channel, which
+    // may be added by the embed, rotation and mask stages
+    bool no_background =
+        query_->get<Color>("bg", Color::DEFAULT).is_transparent() ||
+        (!image.has_alpha() && no_embed && no_rotation && no_mask);
+    bool no_saturate = !query_->exists("sat");
+
+    // Image processing phase 2 (size, crop, etc.)
+    // Note: frames are dropped and identical frames are merged before
+    // anything else.
+    append(decimation, "decimation",
+           n_pages <= 1 ||
+               (!query_->exists("fps") && !query_->exists("maxframes") &&
+                !query_->exists("unique_frames")));
+
+    if (query_->get<bool>("precrop", false)) {
+        if (!no_trim && no_orientation && !no_crop) {
+            // Nothing in between, merge both crops into a single extract
+            stages_.push_back(
+                {"trim+crop", [trim, crop](const VImage &image) {
+                     int left, top, width, height;
+                     std::tie(left, top, width, height) =
+                         trim.resolve_extract(image.width(), image.height());
+
+                     int crop_left, crop_top;
+                     std::tie(crop_left, crop_top, width, height) =
+                         crop.resolve_area(width, height);
+
+                     return image.extract_area(left + crop_left,
+                                               top + crop_top, width, height);
+                 },
+                 false});
+            elided_.emplace_back("orientation");
+        } else {
+            append(trim, "trim", no_trim);
+            append(orientation, "orientation", no_orientation);
+            append(crop, "crop", no_crop);
+        }
+
+        append(thumbnail, "thumbnail", false);
+        append(alignment, "alignment", fit != Canvas::Crop);
+    } else {
+        append(trim, "trim", no_trim);
+        append(thumbnail, "thumbnail", false);
+        append(orientation, "orientation", no_orientation);
+        append(alignment, "alignment", fit != Canvas::Crop);
+        append(crop, "crop", no_crop);
+    }
+
+    // Image processing phase 3 (adjustments, effects, etc.)
+    // Note: the per-pixel stages are planned after the downscale. Their order
+    // is kept, moving them across the canvas changing stages (embed, rotation,
+    // background and mask) would alter the output.
+    // The stages after embed run on each frame, so that rotations and masks
+    // are possible on multi-page images and convolutions don't bleed across
+    // frames. Embed keeps the height of the strip in toilet-roll mode.
+    append(embed, "embed", no_embed);
+    append(rotation, "rotation", no_rotation, true);
+    append(adjustment, "adjustment",
+           !query_->exists("bri") && !query_->exists("con") &&
+               !query_->exists("gam"),
+           true);
+    append(sharpen, "sharpen", !query_->exists("sharp"), true);
+
+    if ((filter_type == FilterType::Sepia ||
+         filter_type == FilterType::Negate) &&
+        no_blur && no_tint && no_background && no_mask && !no_saturate) {
+        // Nothing in between, combine the filter and the saturation into a
+        // single recombination
+        append(recombination, "filter+saturate", false, true);
+        elided_.insert(elided_.end(), {"blur", "tint", "background", "mask"});
+    } else {
+        append(filter, "filter", filter_type == FilterType::None, true);
+        append(blur, "blur", no_blur, true);
+        append(tint, "tint", no_tint, true);
+        append(background, "background", no_background, true);
+        append(mask, "mask", no_mask, true);
+        append(saturate, "saturate", no_saturate, true);
+    }
+}
+
+std::string Pipeline::to_json() const {
+    std::ostringstream json;
+    json << R"({"stages":[)";
+    for (auto it = stages_.begin(); it != stages_.end(); ++it) {
+        if (it != stages_.begin()) {
+            json << ",";
+        }
+        json << R"(")" << it->name << R"(")";
+    }
+    json << R"(],"elided":[)";
+    for (auto it = elided_.begin(); it != elided_.end(); ++it) {
+        if (it != elided_.begin()) {
+            json << ",";
+        }
+        json << R"(")" << *it << R"(")";
+    }
+    json << "]}";
+
+    return json.str();
+}
+
+VImage Pipeline::process_frames(const VImage &image, StageIterator first,
+                                StageIterator last) const {
+    auto run = [first, last](VImage frame) {
+        for (auto it = first; it != last; ++it) {
+            frame = it->run(frame);
+        }
+        return frame;
+    };
+
+    auto n_pages = query_->get<int>("n", 1);
+    auto page_height = query_->get<int>("page_height", image.height());
+
+    // Not a multi-page image or the frames are not evenly stacked
+    if (n_pages <= 1 || image.height() != page_height * n_pages) {
+        return run(image);
+    }
+
+    // The processors skip or special-case toilet-roll mode, process each
+    // frame as a single-page image
+    query_->update("n", 1);
+
+    std::vector<VImage> frames;
+    frames.reserve(n_pages);
+
+    for (int i = 0; i < n_pages; ++i) {
+        frames.push_back(run(image.extract_area(0, i * page_height,
+                                                image.width(), page_height)));
+    }
+
+    query_->update("n", n_pages);
+
+    // The frames may have changed in size (e.g. by a rotation)
+    query_->update("page_height", frames[0].height());
+
+    return VImage::arrayjoin(frames, VImage::option()->set("across", 1));
+}
+
+VImage Pipeline::process(const VImage &image) const {
+    auto output_image = image;
+
+    for (auto it = stages_.begin(); it != stages_.end();) {
+        if (!it->per_frame) {
+            output_image = it->run(output_image);
+            ++it;
+            continue;
+        }
+
+        // Run all consecutive per-frame stages at once
+        auto last = std::find_if(it, stages_.end(), [](const Stage &stage) {
+            return !stage.per_frame;
+        });
+        output_image = process_frames(output_image, it, last);
+        it = last;
+    }
+
+    return output_image;
+}
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "processors/adjustment.h"
+#include "processors/alignment.h"
+#include "processors/background.h"
+#include "processors/base.h"
+#include "processors/blur.h"
+#include "processors/crop.h"
+#include "processors/decimation.h"
+#include "processors/embed.h"
+#include "processors/filter.h"
+#include "processors/mask.h"
+#include "processors/orientation.h"
+#include "processors/recombination.h"
+#include "processors/rotation.h"
+#include "processors/saturate.h"
+#include "processors/sharpen.h"
+#include "processors/thumbnail.h"
+#include "processors/tint.h"
+#include "processors/trim.h"
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+/**
+ * The image processing phases 2 (size, crop, etc.) and 3 (adjustments,
+ * effects, etc.) as an explicit plan, which is built once from the query and
+ * the image header.
+ */
+class Pipeline : ImageProcessor {
+ public:
+    using ImageProcessor::ImageProcessor;
+
+    /**
+     * Build the plan. Stages that are known to leave the image untouched are
+     * dropped, adjacent crops are merged into a single extract and an
+     * adjacent filter and saturation into a single recombination.
+     * @note Needs to be called after the trim area is resolved and any
+     *       shrink-on-load is done.
+     * @param image The source image.
+     */
+    void plan(const VImage &image);
+
+    /**
+     * Describe the plan as JSON, useful for debugging (`&explain=1`).
+     * @return The plan as JSON string.
+     */
+    std::string to_json() const;
+
+    VImage process(const VImage &image) const override;
+
+ private:
+    struct Stage {
+        /**
+         * Name of the stage, as shown by `to_json`.
+         */
+        std::string name;
+
+        /**
+         * Function which runs this stage on an image.
+         */
+        std::function<VImage(const VImage &)> run;
+
+        /**
+         * Should this stage run on each frame of a multi-page image?
+         */
+        bool per_frame;
+    };
+
+    using StageIterator = std::vector<Stage>::const_iterator;
+
+    /**
+     * Run a range of per-frame stages. Multi-page images are split into
+     * frames, each frame is processed as a single-page image and the frames
+     * are joined again. The frames are independent pipelines, so libvips'
+     * threadpool can render them concurrently.
+     * @param image The (multi-page) image.
+     * @param first The first stage to run.
+     * @param last Past the last stage to run.
+     * @return The processed image.
+     */
+    VImage process_frames(const VImage &image, StageIterator first,
+                          StageIterator last) const;
+
+    /**
+     * Append a stage to the plan or, if it's known to leave the image
+     * untouched, to the list of elided stages.
+     * @param processor The processor to run.
+     * @param name Name of the stage.
+     * @param identity Is the stage known to leave the image untouched?
+     * @param per_frame Should the stage run on each frame?
+     */
+    template <typename Processor>
+    void append(const Processor &processor, const std::string &name,
+                bool identity, bool per_frame = false) {
+        if (identity) {
+            elided_.push_back(name);
+            return;
+        }
+
+        stages_.push_back({name,
+                           [processor](const VImage &image) {
+                               return image | processor;
+                           },
+                           per_frame});
+    }
+
+    /**
+     * Stages to run, in order.
+     */
+    std::vector<Stage> stages_;
+
+    /**
+     * Names of the stages that were dropped.
+     */
+    std::vector<std::string> elided_;
+};
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
@@ -0,0 +1,66 @@
+#include "processors/recombination.h"
+
+#include "processors/filter.h"
+#include "processors/saturate.h"
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+ColourTransform ColourTransform::then(const ColourTransform &next) const {
+    ColourTransform combined{};
+
+    for (int row = 0; row < 3; ++row) {
+        combined.offset[row] = next.offset[row];
+
+        for (int col = 0; col < 3; ++col) {
+            const double m = next.matrix[row * 3 + col];
+
+            for (int k = 0; k < 3; ++k) {
+                combined.matrix[row * 3 + k] += m * matrix[col * 3 + k];
+            }
+            combined.offset[row] += m * offset[col];
+        }
+    }
+
+    return combined;
+}
+
+VImage ColourTransform::apply(const VImage &image) const {
+    auto rgb = image.colourspace(VIPS_INTERPRETATION_sRGB);
+
+    VImage alpha;
+    bool has_alpha = rgb.has_alpha();
+    if (has_alpha) {
+        // Separate alpha channel
+        alpha = rgb[rgb.bands() - 1];
+        rgb = rgb.extract_band(0, VImage::option()->set("n", rgb.bands() - 1));
+    }
+
+    // Takes a copy of the matrix
+    auto transformed = rgb.recomb(
+        VImage::new_matrix(3, 3, const_cast<double *>(matrix.data()), 9));
+
+    if (offset[0] != 0.0 || offset[1] != 0.0 || offset[2] != 0.0) {
+        transformed = transformed.linear(
+            1, std::vector<double>(offset.begin(), offset.end()));
+    }
+
+    // The recombination is done in float, cast back to 8-bit
+    transformed = transformed.cast(VIPS_FORMAT_UCHAR);
+
+    return has_alpha ? transformed.bandjoin(alpha) : transformed;
+}
+
+VImage Recombination::process(const VImage &image) const {
+    auto filter = Filter(query_);
+    auto saturate = Saturate(query_);
+
+    return filter.resolve_transform()
+        .then(saturate.resolve_transform())
+        .apply(image);
+}
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
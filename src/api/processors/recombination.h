@@ -0,0 +1,57 @@
+#pragma once
+
+#include "processors/base.h"
+
+#include <array>
+#include <vector>
+
+namespace weserv {
+namespace api {
+namespace processors {
+
+/**
+ * An affine transform of the colour bands of an sRGB image, each pixel
+ * becomes `matrix * pixel + offset`.
+ */
+struct ColourTransform {
+    /**
+     * The 3x3 recombination matrix, row by row.
+     */
+    std::array<double, 9> matrix;
+
+    /**
+     * Offset added to each colour band, after the recombination.
+     */
+    std::array<double, 3> offset;
+
+    /**
+     * Combine with a transform that is applied after this one.
+     * @param next The transform to apply afterwards.
+     * @return The combined transform.
+     */
+    ColourTransform then(const ColourTransform &next) const;
+
+    /**
+     * Apply the transform in a single recombination. The image is converted
+     * to sRGB, its alpha channel (if any) is passed through untouched.
+     * @param image The image to transform.
+     * @return The transformed (8-bit) image.
+     */
+    VImage apply(const VImage &image) const;
+};
+
+/**
+ * The sepia or negate filter, followed by the saturation, as a single
+ * recombination. Only planned when nothing runs in between, see
+ * `Pipeline::plan`.
+ */
+class Recombination : ImageProcessor {
+ public:
+    using ImageProcessor::ImageProcessor;
+
+    VImage process(const VImage &image) const override;
+};
+
+}  // namespace processors
+}  // namespace api
+}  // namespace weserv
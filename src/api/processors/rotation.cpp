@@ -6,6 +6,56 @@ namespace processors {
 
 using parsers::Color;
 
+// Height of the cached strips of the input image
+const int TILE_HEIGHT = 16;
+
+VImage Rotation::rotation_cache(const VImage &image,
+                                const int rotation) const {
+    double radians = rotation * M_PI / 180.0;
+    double sin_angle = std::abs(std::sin(radians));
+    double cos_angle = std::cos(radians);
+
+    int image_width = image.width();
+    int image_height = image.height();
+
+    // The sinks compute the output in buffers of `n_lines` scanlines, and
+    // keep two of them in flight (one is written while the worker threads
+    // compute the next one), see vips_get_tile_size() and vips_sink_disc().
+    // The buffer size depends on the number of worker threads.
+    int tile_width;
+    int tile_height;
+    int n_lines;
+    vips_get_tile_size(image.get_image(), &tile_width, &tile_height,
+                       &n_lines);
+    int output_lines = 2 * n_lines;
+
+    // A horizontal line of the output image maps to a slanted line on the
+    // input image, its vertical extent is the footprint of the rotation
+    double output_width =
+        image_width * std::abs(cos_angle) + image_height * sin_angle;
+    int footprint = static_cast<int>(std::ceil(
+        output_width * sin_angle + output_lines * std::abs(cos_angle)));
+
+    // Add a strip on both sides for the interpolator, and for the strip
+    // that's not aligned with the tiles
+    footprint += 4 * TILE_HEIGHT;
+
+    // The input image is read bottom-up for angles between 90 and 270
+    // degrees, or the footprint covers the whole image
+    if (cos_angle <= 0 || footprint >= image_height) {
+        // Need to copy to memory, we have to stay seq
+        return image.copy_memory();
+    }
+
+    return image.tilecache(
+        VImage::option()
+            ->set("tile_width", image_width)
+            ->set("tile_height", TILE_HEIGHT)
+            ->set("max_tiles", footprint / TILE_HEIGHT + 2)
+            ->set("access", VIPS_ACCESS_SEQUENTIAL)
+            ->set("threaded", true));
+}
+
 VImage Rotation::process(const VImage &image) const {
     // Only arbitrary angles are valid
     auto rotation = query_->get_if<int>(
@@ -25,10 +75,9 @@ VImage Rotation::process(const VImage &image) const {
         query_->update("has_alpha", bg.has_alpha_channel());
     }
 
-    // Need to copy to memory, we have to stay seq
-    return utils::ensure_alpha(image).copy_memory().rotate(
-        static_cast<double>(rotation),
-        VImage::option()->set("background", bg.to_rgba()));
+    return rotation_cache(utils::ensure_alpha(image), rotation)
+        .rotate(static_cast<double>(rotation),
+                VImage::option()->set("background", bg.to_rgba()));
 }
 
 }  // namespace processors
@@ -2,6 +2,8 @@
 
 #include "processors/base.h"
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 namespace weserv {
@@ -13,6 +15,18 @@ class Rotation : ImageProcessor {
     using ImageProcessor::ImageProcessor;
 
     VImage process(const VImage &image) const override;
+
+ private:
+    /**
+     * Insert a tile cache that holds the vertical footprint of the rotation,
+     * so that input tiles can be pulled on demand while we stay sequential.
+     * Falls back to copying the image to memory when the rotation needs
+     * (nearly) all of it at once.
+     * @param image The image to rotate.
+     * @param rotation The angle of rotation in degrees.
+     * @return A new image.
+     */
+    VImage rotation_cache(const VImage &image, int rotation) const;
 };
 
 }  // namespace processors
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "processors/base.h"
+#include "processors/recombination.h"
 
 namespace weserv {
 namespace api {
@@ -10,7 +11,21 @@ class Saturate : ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
+    /**
+     * The saturation as a colour transform, so that it can be combined with
+     * a filter (see `Recombination`).
+     * @return The colour transform.
+     */
+    ColourTransform resolve_transform() const;
+
     VImage process(const VImage &image) const override;
+
+ private:
+    /**
+     * Resolve the saturation multiplier, 1.0 leaves the image untouched.
+     * @return The multiplier.
+     */
+    float resolve_multiplier() const;
 };
 
 }  // namespace processors
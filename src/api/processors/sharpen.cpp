@@ -4,6 +4,16 @@ namespace weserv {
 namespace api {
 namespace processors {
 
+// Mask of the fast, mild sharpen
+// clang-format off
+const std::array<double, 9> MILD_SHARPEN_MASK = {
+    -1.0, -1.0, -1.0,
+    -1.0, 32.0, -1.0,
+    -1.0, -1.0, -1.0
+};
+// clang-format on
+const double MILD_SHARPEN_SCALE = 24.0;
+
 VImage Sharpen::process(const VImage &image) const {
     // Should we process the image?
     if (!query_->exists("sharp")) {
@@ -22,13 +32,10 @@ VImage Sharpen::process(const VImage &image) const {
 
     if (sigma == -1.0F) {
         // Fast, mild sharpen
-        // clang-format off
-        auto sharpen = VImage::new_matrixv(3, 3,
-                                           -1.0, -1.0, -1.0,
-                                           -1.0, 32.0, -1.0,
-                                           -1.0, -1.0, -1.0);
-        // clang-format on
-        sharpen.set("scale", 24.0);
+        // Takes a copy of the mask
+        auto sharpen = VImage::new_matrix(
+            3, 3, const_cast<double *>(MILD_SHARPEN_MASK.data()), 9);
+        sharpen.set("scale", MILD_SHARPEN_SCALE);
         return image.conv(sharpen);
     } else {
         // Slope for flat areas
@@ -2,6 +2,8 @@
 
 #include "processors/base.h"
 
+#include <array>
+
 namespace weserv {
 namespace api {
 namespace processors {
@@ -6,6 +6,7 @@ namespace processors {
 
 using enums::ImageType;
 using enums::Output;
+using enums::WebpPreset;
 using vips::VError;
 
 // Should be plenty
@@ -14,12 +15,64 @@ const int MAX_PAGES = 256;
 // The default quality of 85 usually produces excellent results
 const int DEFAULT_QUALITY = 85;
 
+// Thumbnails (with both requested dimensions at most 400 pixels) are always
+// saved with 4:2:0 chroma subsampling as JPEG, even at high qualities
+const int MAX_THUMBNAIL_SIZE = 400;
+
+// The quantization table of the mozjpeg preset (ImageMagick's table, tuned
+// for PSNR-HVS-M)
+const int MOZJPEG_QUANT_TABLE = 3;
+
 // A default compromise between speed and compression (Z_DEFAULT_COMPRESSION)
 const int DEFAULT_LEVEL = 6;
 
+// The default effort of libwebp (`-m 4`)
+const int DEFAULT_WEBP_EFFORT = 4;
+
+// A fast default for the quantisation effort of palette images (libvips
+// defaults to 7)
+const int DEFAULT_PALETTE_EFFORT = 4;
+
+// AV1 reaches a similar visual quality at a much lower setting
+const int DEFAULT_AVIF_QUALITY = 50;
+
+// The default effort of libvips (speed 5 before libvips 8.12)
+const int DEFAULT_AVIF_EFFORT = 4;
+
+// The default effort of libjxl ("squirrel")
+const int DEFAULT_JXL_EFFORT = 7;
+
 // = 71 megapixels
 const int MAX_IMAGE_SIZE = 71000000;
 
+// Images larger than this (= 16 megapixels) are not classified as photo or
+// graphic for `&output=auto`, since the image needs to be rendered to memory
+const int MAX_CLASSIFY_SIZE = 16000000;
+
+// The range of qualities tried by the adaptive quality search
+const int MIN_ADAPTIVE_QUALITY = 20;
+const int MAX_ADAPTIVE_QUALITY = 95;
+
+// Images larger than this (= 16 megapixels) are saved with a fixed quality,
+// since the image needs to be rendered to memory
+const int MAX_ADAPTIVE_SIZE = 16000000;
+
+// A structural similarity of 0.99 (on a downscaled comparison) is hardly
+// distinguishable from the original
+const double TARGET_SSIM = 0.99;
+
+// Width of the images used for the similarity comparison
+const int COMPARISON_WIDTH = 512;
+
+// Bound the adaptive quality search to 7 encodes (enough to search the full
+// quality range) and 1 second
+const int MAX_ADAPTIVE_ENCODES = 7;
+const int ADAPTIVE_BUDGET = 1000;
+
+// PNG images larger than this (= 4 megapixels) are deflated on multiple
+// threads, if enabled with `weserv_png_threads`
+const int MIN_PARALLEL_PNG_SIZE = 4000000;
+
 // Do a "best effort" to decode images, even if the data is corrupt or invalid.
 // Set this flag to `true` if you would rather to halt processing and raise an
 // error when loading invalid images.
@@ -228,14 +281,10 @@ VImage Stream::new_from_source(const Source &source) const {
     query_->update(
         "type", utils::underlying_value(utils::determine_image_type(loader)));
 
-    // Don't use sequential mode read, if we're doing a trim.
-    // (it will scan the whole image once to find the crop area)
-    auto access_method = query_->get<int>("trim", 0) != 0
-                             ? VIPS_ACCESS_RANDOM
-                             : VIPS_ACCESS_SEQUENTIAL;
-
+    // Note: we can always use sequential mode read, the trim area is found on
+    // a separate (shrunk) preview of the source.
     vips::VOption *options = VImage::option()
-                                 ->set("access", access_method)
+                                 ->set("access", VIPS_ACCESS_SEQUENTIAL)
                                  ->set("fail", FAIL_ON_ERROR);
 
     int n = 1;
@@ -284,6 +333,45 @@ VImage Stream::new_from_source(const Source &source) const {
     return image;
 }
 
+Output Stream::negotiate_output() const {
+    if (!query_->exists("accept")) {
+        return Output::Origin;
+    }
+
+    auto accepted = query_->get<std::vector<int>>("accept");
+    auto is_accepted = [&accepted](Output output) {
+        return std::find(accepted.begin(), accepted.end(),
+                         utils::underlying_value(output)) != accepted.end();
+    };
+
+    // AVIF is the smallest, but libvips saves the pages of an animation as
+    // separate (still) images
+    if (query_->get<int>("n", 1) == 1 && is_accepted(Output::Avif) &&
+        utils::is_output_supported(Output::Avif)) {
+        return Output::Avif;
+    }
+
+    // WebP supports both alpha and animations
+    if (is_accepted(Output::Webp) && utils::is_output_supported(Output::Webp)) {
+        return Output::Webp;
+    }
+
+    return Output::Origin;
+}
+
+Output Stream::select_output(const VImage &image, const Output &origin) const {
+    auto content = utils::classify_content(image);
+
+    // Graphics compress best without loss, photos need an alpha-capable
+    // output when they are (semi-)transparent
+    auto output =
+        content.graphic || content.uses_alpha ? Output::Png : Output::Jpeg;
+
+    utils::record_content(content, origin, output);
+
+    return output;
+}
+
 template <>
 void Stream::append_save_options<Output::Jpeg>(vips::VOption *options) const {
     auto quality = query_->get_if<int>(
@@ -303,6 +391,57 @@ void Stream::append_save_options<Output::Jpeg>(vips::VOption *options) const {
 
     // Enable libjpeg's Huffman table optimiser
     options->set("optimize_coding", true);
+
+    // The mozjpeg preset enables all of its size optimisations, which may
+    // be toggled separately as well (needs mozjpeg-capable libjpeg)
+    auto mozjpeg = query_->get<bool>("mozjpeg", false);
+    auto quant_table = query_->get_if<int>(
+        "qtable",
+        [](int t) {
+            // Quantization table needs to be in the range
+            // of 0 - 8
+            return t >= 0 && t <= 8;
+        },
+        mozjpeg ? MOZJPEG_QUANT_TABLE : 0);
+
+    options->set("trellis_quant", query_->get<bool>("trellis", mozjpeg));
+    options->set("overshoot_deringing",
+                 query_->get<bool>("deringing", mozjpeg));
+    options->set("optimize_scans", query_->get<bool>("scans", mozjpeg));
+    options->set("quant_table", quant_table);
+
+    // Chroma subsampling, automatic (only below quality 90) by default and
+    // always for thumbnails
+    auto width = query_->get<int>("w", 0);
+    auto height = query_->get<int>("h", 0);
+    bool thumbnail = (width > 0 || height > 0) &&
+                     width <= MAX_THUMBNAIL_SIZE &&
+                     height <= MAX_THUMBNAIL_SIZE;
+    auto chroma = query_->get<int>("chroma", thumbnail ? 420 : 0);
+#if VIPS_VERSION_AT_LEAST(8, 11, 0)
+    if (chroma == 444) {
+        options->set("subsample_mode", VIPS_FOREIGN_SUBSAMPLE_OFF);
+    } else if (chroma == 420) {
+        options->set("subsample_mode", VIPS_FOREIGN_SUBSAMPLE_ON);
+    }
+#else
+    // 4:2:0 can't be forced at high qualities
+    options->set("no_subsample", chroma == 444);
+#endif
+
+#if VIPS_VERSION_AT_LEAST(8, 12, 0)
+    auto restart_interval = query_->get_if<int>(
+        "restart",
+        [](int r) {
+            // Restart interval needs to be in the range
+            // of 0 (none) - 1000 MCU rows
+            return r >= 0 && r <= 1000;
+        },
+        0);
+
+    // Add restart markers, for resilience against corruption
+    options->set("restart_interval", restart_interval);
+#endif
 }
 
 template <>
@@ -327,6 +466,13 @@ void Stream::append_save_options<Output::Png>(vips::VOption *options) const {
 
     // Use adaptive row filtering (default is none)
     options->set("filter", filter);
+
+    if (query_->get<bool>("palette", false)) {
+        // Quantise to an 8-bit palette
+        options->set("palette", true);
+
+        append_palette_options(options);
+    }
 }
 
 template <>
@@ -340,11 +486,78 @@ void Stream::append_save_options<Output::Webp>(vips::VOption *options) const {
         },
         DEFAULT_QUALITY);
 
+    // The default effort may be configured per location
+    // (`weserv_webp_effort`)
+    auto default_effort = query_->get_if<int>(
+        "webp_effort", [](int e) { return e >= 0 && e <= 6; },
+        DEFAULT_WEBP_EFFORT);
+    auto effort = query_->get_if<int>(
+        "effort",
+        [](int e) {
+            // Effort needs to be in the range of
+            // 0 (fastest) - 6 (slowest)
+            return e >= 0 && e <= 6;
+        },
+        default_effort);
+
     // Set quality (default is 85)
     options->set("Q", quality);
 
     // Set quality of alpha layer to 100
     options->set("alpha_q", 100);
+
+    // Set the CPU effort (default is 4)
+#if VIPS_VERSION_AT_LEAST(8, 12, 0)
+    options->set("effort", effort);
+#else
+    options->set("reduction_effort", effort);
+#endif
+
+    // Encode losslessly or, with near-lossless, preprocess the image to
+    // make it compress better losslessly (the quality sets the amount)
+    if (query_->get<bool>("lossless", false)) {
+        options->set("lossless", true);
+    } else if (query_->get<bool>("nearlossless", false)) {
+        options->set("near_lossless", true);
+    }
+
+    // Use the sharper (but slower) RGB->YUV conversion
+    options->set("smart_subsample", query_->get<bool>("smartsub", false));
+
+    // Tune the encoder for the type of image
+    options->set("preset",
+                 static_cast<int>(query_->get<WebpPreset>(
+                     "preset", WebpPreset::Default)));
+
+    if (query_->get<int>("n", 1) > 1) {
+        // Minimise the size of animations, at the cost of the encode time
+        options->set("min_size", query_->get<bool>("minsize", false));
+
+        auto kmax = query_->get_if<int>(
+            "kmax",
+            [](int k) {
+                // Maximum keyframe distance needs to be in the range
+                // of 0 (only keyframes) - 256
+                return k >= 0 && k <= 256;
+            },
+            -1);
+        auto kmin = query_->get_if<int>(
+            "kmin",
+            [](int k) {
+                // Minimum keyframe distance needs to be in the range
+                // of 0 - 256
+                return k >= 0 && k <= 256;
+            },
+            -1);
+
+        // Note: libwebp lowers kmin if it isn't smaller than kmax
+        if (kmax != -1) {
+            options->set("kmax", kmax);
+        }
+        if (kmin != -1) {
+            options->set("kmin", kmin);
+        }
+    }
 }
 
 template <>
@@ -367,8 +580,156 @@ void Stream::append_save_options<Output::Tiff>(vips::VOption *options) const {
 
 template <>
 void Stream::append_save_options<Output::Gif>(vips::VOption *options) const {
+#if VIPS_VERSION_AT_LEAST(8, 12, 0)
+    // Saved with the built-in GIF saver, which always quantises
+    append_palette_options(options);
+
+#if VIPS_VERSION_AT_LEAST(8, 13, 0)
+    // Reuse the palette of the input image, if possible
+    options->set("reuse", query_->get<bool>("reuse", false));
+
+    auto interframe = query_->get_if<float>(
+        "interframe",
+        [](float i) {
+            // Maximum inter-frame error needs to be in the range of
+            // 0 (lossless) - 32
+            return i >= 0 && i <= 32;
+        },
+        0.0F);
+
+    // Make pixels that barely change between frames transparent
+    options->set("interframe_maxerror", interframe);
+#endif
+#else
     // Set the format option to hint the file type
     options->set("format", "gif");
+#endif
+}
+
+template <>
+void Stream::append_save_options<Output::Avif>(vips::VOption *options) const {
+    auto quality = query_->get_if<int>(
+        "q",
+        [](int q) {
+            // Quality needs to be in the range
+            // of 1 - 100
+            return q >= 1 && q <= 100;
+        },
+        DEFAULT_AVIF_QUALITY);
+
+    auto effort = query_->get_if<int>(
+        "effort",
+        [](int e) {
+            // Effort needs to be in the range of
+            // 0 (fastest) - 9 (slowest)
+            return e >= 0 && e <= 9;
+        },
+        DEFAULT_AVIF_EFFORT);
+
+    // Set quality (default is 50)
+    options->set("Q", quality);
+
+#if VIPS_VERSION_AT_LEAST(8, 9, 0)
+    // Use AV1 compression within the HEIF container
+    options->set("compression", VIPS_FOREIGN_HEIF_COMPRESSION_AV1);
+#endif
+
+    // Set the CPU effort (default is 4)
+#if VIPS_VERSION_AT_LEAST(8, 12, 0)
+    options->set("effort", effort);
+#elif VIPS_VERSION_AT_LEAST(8, 10, 0)
+    // Speed is the inverse of effort, in the range of 0 - 8
+    options->set("speed", std::min(8, 9 - effort));
+#endif
+
+#if VIPS_VERSION_AT_LEAST(8, 13, 0)
+    // Chroma subsampling, automatic (only at lower qualities) by default
+    auto chroma = query_->get<int>("chroma", 0);
+    if (chroma == 444) {
+        options->set("subsample_mode", VIPS_FOREIGN_SUBSAMPLE_OFF);
+    } else if (chroma == 420) {
+        options->set("subsample_mode", VIPS_FOREIGN_SUBSAMPLE_ON);
+    }
+#endif
+}
+
+template <>
+void Stream::append_save_options<Output::Jxl>(vips::VOption *options) const {
+    auto quality = query_->get_if<int>(
+        "q",
+        [](int q) {
+            // Quality needs to be in the range
+            // of 1 - 100
+            return q >= 1 && q <= 100;
+        },
+        DEFAULT_QUALITY);
+
+    auto effort = query_->get_if<int>(
+        "effort",
+        [](int e) {
+            // Effort needs to be in the range of
+            // 1 (fastest) - 9 (slowest)
+            return e >= 1 && e <= 9;
+        },
+        DEFAULT_JXL_EFFORT);
+
+    // Set quality (default is 85)
+    options->set("Q", quality);
+
+    // Set the encoding effort (default is 7)
+    options->set("effort", effort);
+}
+
+void Stream::append_palette_options(vips::VOption *options) const {
+    auto colours = query_->get_if<int>(
+        "colours",
+        [](int c) {
+            // Number of colours needs to be in the range
+            // of 2 - 256
+            return c >= 2 && c <= 256;
+        },
+        256);
+    auto dither = query_->get_if<float>(
+        "dither",
+        [](float d) {
+            // Amount of dithering needs to be in the range
+            // of 0 (none) - 1 (full)
+            return d >= 0 && d <= 1;
+        },
+        1.0F);
+
+#if VIPS_VERSION_AT_LEAST(8, 12, 0)
+    // The number of colours is derived from the bit depth
+    int bitdepth = 8;
+    while (bitdepth > 1 && (1 << (bitdepth / 2)) >= colours) {
+        bitdepth /= 2;
+    }
+
+    bitdepth = query_->get_if<int>(
+        "bitdepth",
+        [](int b) {
+            // Bit depth needs to be one of
+            // 1, 2, 4 or 8
+            return b == 1 || b == 2 || b == 4 || b == 8;
+        },
+        bitdepth);
+
+    auto effort = query_->get_if<int>(
+        "effort",
+        [](int e) {
+            // Effort needs to be in the range of
+            // 1 (fastest) - 10 (slowest)
+            return e >= 1 && e <= 10;
+        },
+        DEFAULT_PALETTE_EFFORT);
+
+    options->set("bitdepth", bitdepth);
+    options->set("effort", effort);
+#else
+    options->set("colours", colours);
+#endif
+
+    options->set("dither", dither);
 }
 
 void Stream::append_save_options(const Output &output,
@@ -386,6 +747,12 @@ void Stream::append_save_options(const Output &output,
         case Output::Gif:
             append_save_options<Output::Gif>(options);
             break;
+        case Output::Avif:
+            append_save_options<Output::Avif>(options);
+            break;
+        case Output::Jxl:
+            append_save_options<Output::Jxl>(options);
+            break;
         case Output::Png:
         default:
             append_save_options<Output::Png>(options);
@@ -393,6 +760,178 @@ void Stream::append_save_options(const Output &output,
     }
 }
 
+bool Stream::is_adaptive_quality_needed(const VImage &image,
+                                        const Output &output) const {
+    if (!query_->get<bool>("q_auto", false) &&
+        query_->get<int>("maxbytes", 0) <= 0) {
+        return false;
+    }
+
+    // Only the lossy outputs have a quality setting
+    if (output != Output::Jpeg && output != Output::Webp &&
+        output != Output::Avif && output != Output::Jxl) {
+        return false;
+    }
+
+    return static_cast<int64_t>(image.width()) * image.height() <=
+           MAX_ADAPTIVE_SIZE;
+}
+
+bool Stream::is_parallel_png_needed(const VImage &image,
+                                    const Output &output) const {
+    if (output != Output::Png || query_->get<int>("png_threads", 1) <= 1) {
+        return false;
+    }
+
+    // Interlaced and palette images are left to libpng
+    if (query_->get<bool>("il", false) || query_->get<bool>("palette", false)) {
+        return false;
+    }
+
+    return static_cast<int64_t>(image.width()) * image.height() >
+           MIN_PARALLEL_PNG_SIZE;
+}
+
+std::string Stream::save_to_buffer(const VImage &image, const Output &output,
+                                   const std::string &extension,
+                                   const int quality) const {
+    query_->update("q", quality);
+
+    // Strip all metadata (EXIF, XMP, IPTC).
+    // (all savers supports this option)
+    vips::VOption *save_options = VImage::option()->set("strip", true);
+
+    append_save_options(output, save_options);
+
+    void *buf;
+    size_t size;
+
+    image.write_to_buffer(extension.c_str(), &buf, &size, save_options);
+
+    std::string buffer(static_cast<char *>(buf), size);
+
+    g_free(buf);
+
+    return buffer;
+}
+
+std::string
+Stream::save_with_adaptive_quality(const VImage &image, const Output &output,
+                                   const std::string &extension) const {
+    auto start = std::chrono::steady_clock::now();
+
+    auto max_bytes = static_cast<size_t>(
+        std::max(0, query_->get<int>("maxbytes", 0)));
+    auto max_quality = query_->get_if<int>(
+        "q",
+        [](int q) {
+            // Quality needs to be in the range
+            // of 1 - 100
+            return q >= 1 && q <= 100;
+        },
+        output == Output::Avif ? DEFAULT_AVIF_QUALITY : DEFAULT_QUALITY);
+    if (query_->get<bool>("q_auto", false)) {
+        max_quality = MAX_ADAPTIVE_QUALITY;
+    }
+    int min_quality = std::min(MIN_ADAPTIVE_QUALITY, max_quality);
+
+    // The image is saved multiple times, render it to memory once
+    auto memory = image.copy_memory();
+
+    std::map<int, std::string> candidates;
+    auto save = [&](int quality) -> const std::string & {
+        auto it = candidates.find(quality);
+        if (it == candidates.end()) {
+            it = candidates
+                     .emplace(quality, save_to_buffer(memory, output,
+                                                      extension, quality))
+                     .first;
+        }
+        return it->second;
+    };
+    auto within_budget = [&]() {
+        return static_cast<int>(candidates.size()) < MAX_ADAPTIVE_ENCODES &&
+               std::chrono::steady_clock::now() - start <
+                   std::chrono::milliseconds(ADAPTIVE_BUDGET);
+    };
+
+    int quality = max_quality;
+
+    if (query_->get<bool>("q_auto", false)) {
+        // Only the first page is compared, that's also what's loaded from
+        // the formatted candidates
+        auto page_height = query_->get<int>("page_height", memory.height());
+        auto reference = utils::prepare_comparison(
+            memory.extract_area(0, 0, memory.width(),
+                                std::min(page_height, memory.height())),
+            COMPARISON_WIDTH);
+
+        // Find the lowest quality that is still similar
+        int low = min_quality;
+        int high = max_quality;
+        while (low < high && within_budget()) {
+            int mid = low + (high - low) / 2;
+
+            const std::string &buffer = save(mid);
+            auto candidate = utils::prepare_comparison(
+                VImage::new_from_buffer(buffer.data(), buffer.size(), ""),
+                COMPARISON_WIDTH);
+
+            if (utils::ssim(reference, candidate) >= TARGET_SSIM) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+
+        quality = high;
+
+        // Out of budget before the maximum quality was tried, all tried
+        // qualities are below the target similarity. The highest of these
+        // is the closest.
+        if (candidates.count(quality) == 0 && !candidates.empty() &&
+            !within_budget()) {
+            quality = candidates.rbegin()->first;
+        }
+    }
+
+    if (max_bytes > 0 && save(quality).size() > max_bytes) {
+        // Find the highest quality that fits, or the lowest quality
+        int low = min_quality;
+        int high = quality - 1;
+        while (low < high && within_budget()) {
+            int mid = low + (high - low + 1) / 2;
+
+            if (save(mid).size() <= max_bytes) {
+                low = mid;
+            } else {
+                high = mid - 1;
+            }
+        }
+
+        quality = low;
+
+        // Out of budget before the lowest quality was tried, take the
+        // highest tried quality that fits, or the smallest candidate
+        if (candidates.count(quality) == 0 && !within_budget()) {
+            auto best = candidates.end();
+            for (auto it = candidates.begin(); it != candidates.end(); ++it) {
+                if (best == candidates.end() ||
+                    it->second.size() <= max_bytes ||
+                    it->second.size() < best->second.size()) {
+                    best = it;
+                }
+            }
+
+            quality = best->first;
+        }
+    }
+
+    save(quality);
+
+    return std::move(candidates[quality]);
+}
+
 void Stream::write_to_target(const VImage &image, const Target &target) const {
     // Attaching metadata, need to copy the image
     auto copy = image.copy();
@@ -443,6 +982,17 @@ void Stream::write_to_target(const VImage &image, const Target &target) const {
         target.write(out.c_str(), out.size());
         target.finish();
     } else {
+        bool auto_output = output == Output::Auto;
+        if (auto_output) {
+            output = negotiate_output();
+        }
+
+        // Honor the origin image format if the requested output can't be
+        // saved with this libvips build (e.g. without AV1 or JPEG XL support)
+        if (output != Output::Origin && !utils::is_output_supported(output)) {
+            output = Output::Origin;
+        }
+
         if (output == Output::Origin) {
             // We force the output to PNG if the image has alpha and doesn't
             // have the right extension to output alpha (useful for masking and
@@ -453,10 +1003,51 @@ void Stream::write_to_target(const VImage &image, const Target &target) const {
             } else {
                 output = utils::to_output(image_type);
             }
+
+            // Let the content decide between a lossy and lossless output
+            if (auto_output && query_->get<int>("n", 1) == 1 &&
+                (output == Output::Jpeg || output == Output::Png) &&
+                static_cast<int64_t>(copy.width()) * copy.height() <=
+                    MAX_CLASSIFY_SIZE) {
+                // The image is read twice, render it to memory once
+                copy = copy.copy_memory();
+
+                output = select_output(copy, output);
+            }
         }
 
         std::string extension = utils::determine_image_extension(output);
 
+        if (is_adaptive_quality_needed(copy, output)) {
+            std::string buffer =
+                save_with_adaptive_quality(copy, output, extension);
+
+            target.setup(extension);
+            target.write(buffer.data(), buffer.size());
+            target.finish();
+            return;
+        }
+
+        if (is_parallel_png_needed(copy, output)) {
+            auto level = query_->get_if<int>(
+                "l",
+                [](int l) {
+                    // Level needs to be in the range of
+                    // 0 (no Deflate) - 9 (maximum Deflate)
+                    return l >= 0 && l <= 9;
+                },
+                DEFAULT_LEVEL);
+
+            std::string buffer = utils::save_png_parallel(
+                copy, level, query_->get<bool>("af", false),
+                query_->get<int>("png_threads"));
+
+            target.setup(extension);
+            target.write(buffer.data(), buffer.size());
+            target.finish();
+            return;
+        }
+
         // Strip all metadata (EXIF, XMP, IPTC).
         // (all savers supports this option)
         vips::VOption *save_options = VImage::option()->set("strip", true);
@@ -6,8 +6,12 @@
 #include "io/source.h"
 #include "io/target.h"
 #include "processors/base.h"
+#include "utils/content.h"
+#include "utils/png.h"
 
 #include <algorithm>
+#include <chrono>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -79,6 +83,24 @@ class Stream {
      */
     void resolve_rotation_and_flip(const VImage &image) const;
 
+    /**
+     * Negotiate the output for `&output=auto`. Picks the smallest format
+     * accepted by the client that can be saved with this libvips build.
+     * @return The negotiated output or `Output::Origin` if nothing
+     *         better is accepted.
+     */
+    enums::Output negotiate_output() const;
+
+    /**
+     * Select a lossy (JPEG) or lossless (PNG) output for `&output=auto`,
+     * depending on whether the image is a photo or a graphic.
+     * @param image The (single-page) image, rendered to memory.
+     * @param origin The output which mirrors the origin format.
+     * @return The selected output.
+     */
+    enums::Output select_output(const VImage &image,
+                                const enums::Output &origin) const;
+
     /**
      * Append the save options for a specified image output.
      * These options will be passed on to the selected save operation.
@@ -88,6 +110,15 @@ class Stream {
     template <enums::Output Output>
     void append_save_options(vips::VOption *options) const;
 
+    /**
+     * Append the options for a palette-quantised image (`&colours=`,
+     * `&dither=`, `&bitdepth=` and `&effort=`), shared by the PNG and GIF
+     * save operations. The `palette` option itself is only known to the PNG
+     * save operation, the GIF save operation always quantises.
+     * @param options Options to pass on to the selected save operation.
+     */
+    void append_palette_options(vips::VOption *options) const;
+
     /**
      * Append the save options for a specified image output.
      * These options will be passed on to the selected save operation.
@@ -96,6 +127,54 @@ class Stream {
      */
     void append_save_options(const enums::Output &output,
                              vips::VOption *options) const;
+
+    /**
+     * Should the quality be searched for while saving? (i.e. `&q=auto`
+     * and/or `&maxbytes=`)
+     * @param image The image to save.
+     * @param output Image output.
+     * @return A bool indicating if the quality should be searched for.
+     */
+    bool is_adaptive_quality_needed(const VImage &image,
+                                    const enums::Output &output) const;
+
+    /**
+     * Save an image to a memory buffer with the given quality.
+     * @param image The image to save.
+     * @param output Image output.
+     * @param extension Extension of the image output.
+     * @param quality The quality to save with.
+     * @return The formatted image.
+     */
+    std::string save_to_buffer(const VImage &image,
+                               const enums::Output &output,
+                               const std::string &extension,
+                               int quality) const;
+
+    /**
+     * Save an image with the lowest quality that is visually the same
+     * (`&q=auto`) and/or fits within a number of bytes (`&maxbytes=`).
+     * The quality is found with a binary search, which is bounded by a
+     * maximum number of encodes and a time budget. Once out of budget, the
+     * best candidate that was tried is returned.
+     * @param image The image to save.
+     * @param output Image output.
+     * @param extension Extension of the image output.
+     * @return The formatted image.
+     */
+    std::string save_with_adaptive_quality(const VImage &image,
+                                           const enums::Output &output,
+                                           const std::string &extension) const;
+
+    /**
+     * Should the image be saved with the parallel PNG deflate? (i.e. a large,
+     * non-interlaced, non-palette PNG and more than one `weserv_png_threads`)
+     * @param image The image to save.
+     * @param output Image output.
+     * @return A bool indicating if the PNG should be deflated in parallel.
+     */
+    bool is_parallel_png_needed(const VImage &image,
+                                const enums::Output &output) const;
 };
 
 }  // namespace processors
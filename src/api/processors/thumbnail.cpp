@@ -239,15 +239,20 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
     // Try to reload input using shrink-on-load, when:
     //  - the width or height parameters are specified.
     //  - gamma correction doesn't need to be applied.
-    //  - trimming isn't required.
-    if (query_->get<bool>("trim", false) ||
-        query_->get<float>("gam", 0.0F) != 0.0F ||
+    if (query_->get<float>("gam", 0.0F) != 0.0F ||
         (query_->get<int>("w") == 0 && query_->get<int>("h") == 0)) {
         return image;
     }
 
-    int width = image.width();
-    int height = image.height();
+    // The trim area (if any) is cropped after shrink-on-load, so we need to
+    // use the trimmed dimensions to calculate the shrink factor.
+    bool trim = query_->get<bool>("trim", false);
+    int width = trim ? query_->get<int>("trim_width") : image.width();
+    int height = trim ? query_->get<int>("trim_height") : image.height();
+
+    // Height is left untouched in toilet-roll mode
+    int page_height =
+        height == image.height() ? utils::get_page_height(image) : height;
 
     vips::VOption *load_options = VImage::option()
                                       ->set("access", VIPS_ACCESS_SEQUENTIAL)
@@ -267,8 +272,7 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
     } else if (image_type == ImageType::Pdf || image_type == ImageType::Webp) {
         append_page_options(load_options);
 
-        auto scale =
-            1.0 / resolve_common_shrink(width, utils::get_page_height(image));
+        auto scale = 1.0 / resolve_common_shrink(width, page_height);
 
 #if VIPS_VERSION_AT_LEAST(8, 10, 0)
         return VImage::new_from_source(source, "",
@@ -276,7 +280,9 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
         return VImage::new_from_buffer(source.buffer(), "",
 #endif
                                        load_options->set("scale", scale));
-    } else if (image_type == ImageType::Tiff) {
+    } else if (image_type == ImageType::Tiff && !trim) {
+        // Note: we can't pick a pyramid level for a trimmed image, since the
+        // level dimensions are compared against the untrimmed image.
         auto page = resolve_tiff_pyramid(image, source, width, height);
 
         // We've found a pyramid
@@ -319,9 +325,17 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
 #endif
                                     load_options->set("thumbnail", true));
 
+        // Take the trim area into account
+        int thumb_width = static_cast<int>(
+            std::rint(static_cast<double>(thumb.width()) * width /
+                      static_cast<double>(image.width())));
+        int thumb_height = static_cast<int>(
+            std::rint(static_cast<double>(thumb.height()) * height /
+                      static_cast<double>(image.height())));
+
         // Use the thumbnail if, by using it, we could get a factor >= * 1.0,
         // ie. we would not need to expand the thumbnail.
-        return resolve_common_shrink(thumb.width(), thumb.height()) >= 1.0
+        return resolve_common_shrink(thumb_width, thumb_height) >= 1.0
                    ? thumb
                    : image;
 #endif
@@ -336,6 +350,29 @@ VImage Thumbnail::shrink_on_load(const VImage &image,
     return image;
 }
 
+bool Thumbnail::is_srgb_profile(const VImage &image) const {
+    bool is_srgb = false;
+
+#if VIPS_VERSION_AT_LEAST(8, 8, 0)
+    size_t length;
+    const void *data = image.get_blob(VIPS_META_ICC_NAME, &length);
+
+    // Byte-identical to the built-in sRGB profile
+    VipsBlob *srgb;
+    if (vips_profile_load("srgb", &srgb, nullptr) == 0) {
+        size_t srgb_length;
+        const void *srgb_data = vips_blob_get(srgb, &srgb_length);
+        is_srgb = srgb_length == length &&
+                  std::memcmp(srgb_data, data, length) == 0;
+        vips_area_unref(reinterpret_cast<VipsArea *>(srgb));
+    } else {
+        vips_error_clear();  // LCOV_EXCL_LINE
+    }
+#endif
+
+    return is_srgb;
+}
+
 VImage Thumbnail::process(const VImage &image) const {
     // Any pre-shrinking may already have been done
     auto thumb = image;
@@ -365,7 +402,18 @@ VImage Thumbnail::process(const VImage &image) const {
         // we need to cast back to the pre-premultiply format.
         unpremultiplied_format = thumb.format();
 
-        thumb = thumb.premultiply();
+        if (unpremultiplied_format == VIPS_FORMAT_UCHAR) {
+            // Fast path for 8-bit images, the product of an 8-bit colour and
+            // alpha fits in 16 bits. This keeps the resize in the integer
+            // domain, at half the size of a float image.
+            auto alpha = thumb[thumb.bands() - 1];
+            thumb = (thumb.extract_band(
+                         0, VImage::option()->set("n", thumb.bands() - 1)) *
+                     alpha)
+                        .bandjoin(alpha);
+        } else {
+            thumb = thumb.premultiply();
+        }
     }
 
     int thumb_width = thumb.width();
@@ -405,7 +453,16 @@ VImage Thumbnail::process(const VImage &image) const {
 
     query_->update("page_height", target_page_height);
 
-    if (unpremultiplied_format != VIPS_FORMAT_NOTSET) {
+    if (unpremultiplied_format == VIPS_FORMAT_UCHAR) {
+        // Undo the 16-bit premultiply from above, libvips gives zero when
+        // dividing by a zero alpha
+        auto alpha = thumb[thumb.bands() - 1];
+        thumb = (thumb.extract_band(
+                     0, VImage::option()->set("n", thumb.bands() - 1)) /
+                 alpha)
+                    .cast(VIPS_FORMAT_UCHAR)
+                    .bandjoin(alpha.cast(VIPS_FORMAT_UCHAR));
+    } else if (unpremultiplied_format != VIPS_FORMAT_NOTSET) {
         thumb = thumb.unpremultiply().cast(unpremultiplied_format);
     }
 
@@ -417,7 +474,7 @@ VImage Thumbnail::process(const VImage &image) const {
         thumb = thumb.icc_export(VImage::option()
                                      ->set("output_profile", "srgb")
                                      ->set("intent", VIPS_INTENT_PERCEPTUAL));
-    } else if (utils::has_profile(thumb)) {
+    } else if (utils::has_profile(thumb) && !is_srgb_profile(thumb)) {
         thumb = thumb.icc_transform(
             "srgb", VImage::option()
                         // Fallback to srgb
@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <string>
 
 namespace weserv {
@@ -80,6 +81,14 @@ class Thumbnail : ImageProcessor {
      * @param options The source options.
      */
     void append_page_options(vips::VOption *options) const;
+
+    /**
+     * Is the embedded profile byte-identical to the built-in sRGB profile?
+     * Transforming such an image to sRGB doesn't change any pixel values.
+     * @param image The source image, with an embedded profile.
+     * @return A bool indicating if the transform can be skipped.
+     */
+    bool is_srgb_profile(const VImage &image) const;
 };
 
 }  // namespace processors
@@ -4,7 +4,74 @@ namespace weserv {
 namespace api {
 namespace processors {
 
-VImage Trim::process(const VImage &image) const {
+using enums::ImageType;
+
+using io::Source;
+
+VImage new_page_thumbnail(const parsers::QueryHolderPtr &query,
+                          const Source &source, const int width,
+                          const int height) {
+    vips::VOption *options = VImage::option()
+                                 ->set("height", height)
+                                 ->set("size", VIPS_SIZE_DOWN)
+                                 ->set("no_rotate", true);
+
+    // Render the same pages as the source image, if the loader supports this
+    auto image_type = query->get<ImageType>("type", ImageType::Unknown);
+    if (utils::image_type_supports_page(image_type)) {
+        auto page = query->get_if<int>(
+            "page",
+            [](int p) {
+                // Page needs to be in the range of
+                // 0 (numbered from zero) - 100000
+                return p >= 0 && p <= 100000;
+            },
+            0);
+
+        options->set("option_string",
+                     "n=" + std::to_string(query->get<int>("n", 1)) +
+                         ",page=" + std::to_string(page));
+    }
+
+#if VIPS_VERSION_AT_LEAST(8, 10, 0)
+    return VImage::thumbnail_source(source, width, options);
+#else
+    // We don't take a copy of the data or free it
+    auto *blob =
+        vips_blob_new(nullptr, source.buffer().c_str(), source.buffer().size());
+    auto thumbnail = VImage::thumbnail_buffer(blob, width, options);
+    vips_area_unref(reinterpret_cast<VipsArea *>(blob));
+
+    return thumbnail;
+#endif
+}
+
+VImage Trim::new_preview(const VImage &image, const Source &source) const {
+    int image_width = image.width();
+    int page_height = utils::get_page_height(image);
+
+    // The target dimensions are already resolved by the stream processor
+    int target = std::max(query_->get<int>("w", 0), query_->get<int>("h", 0));
+
+    // Be conservative, the smallest axis is divided by the largest target
+    // dimension. This ensures that the preview is never shrunk more than the
+    // output image (regardless of the fit mode or rotation).
+    double shrink = 1.0;
+    if (target > 0) {
+        shrink = std::max(
+            1.0, static_cast<double>(std::min(image_width, page_height)) /
+                     static_cast<double>(target));
+    }
+
+    int preview_width = std::max(
+        1, static_cast<int>(std::rint(image_width / shrink)));
+    int preview_height = std::max(
+        1, static_cast<int>(std::rint(page_height / shrink)));
+
+    return new_page_thumbnail(query_, source, preview_width, preview_height);
+}
+
+void Trim::resolve_area(const VImage &image, const Source &source) const {
     auto threshold = query_->get_if<int>(
         "trim",
         [](int t) {
@@ -14,54 +81,127 @@ VImage Trim::process(const VImage &image) const {
         },
         0);
 
+    // We could use shrink-on-load for the next thumbnail processor
+    query_->update("trim", false);
+
     // Make sure that trimming is required
     if (threshold == 0 || image.width() < 3 || image.height() < 3) {
-        // We could use shrink-on-load for the next thumbnail processor
-        query_->update("trim", false);
-
-        return image;
+        return;
     }
 
+    auto preview = new_preview(image, source);
+
     // Find the value of the pixel at (0, 0), `find_trim` search for all pixels
     // significantly different from this.
-    auto background = image.extract_area(0, 0, 1, 1);
+    auto background = preview.extract_area(0, 0, 1, 1);
 
     // Note: If the image has alpha, we'll need to flatten before `getpoint`
     // to get a correct background value.
-    if (image.has_alpha()) {
+    if (preview.has_alpha()) {
         background = background.flatten();
     }
 
     // Scale up 8-bit values to match 16-bit input image
-    if (utils::is_16_bit(image.interpretation())) {
+    if (utils::is_16_bit(preview.interpretation())) {
         threshold = threshold * 256;
     }
 
     int left, top, width, height;
-    left = image.find_trim(&top, &width, &height,
-                           VImage::option()
-                               ->set("threshold", threshold)
-                               ->set("background", background(0, 0)));
+    left = preview.find_trim(&top, &width, &height,
+                             VImage::option()
+                                 ->set("threshold", threshold)
+                                 ->set("background", background(0, 0)));
 
     // Sanity check, this usually happens when a high tolerance is specified
     if (width == 0 || height == 0) {
-        // We could use shrink-on-load for the next thumbnail processor
-        query_->update("trim", false);
-
-        // Just return the original image
-        return image;
+        return;
     }
 
-    // Skip shrink-on-load for the next thumbnail processor
-    query_->update("trim", true);
+    int image_width = image.width();
+    int image_height = image.height();
+
+    double hscale = static_cast<double>(image_width) /
+                    static_cast<double>(preview.width());
+    double vscale = static_cast<double>(image_height) /
+                    static_cast<double>(preview.height());
+
+    // Scale the bounding box back up to the source image. A pixel on the edge
+    // of the preview may hide some detail, so pad it by one preview pixel if
+    // the preview was shrunk.
+    int hpad = hscale > 1.0 ? 1 : 0;
+    int vpad = vscale > 1.0 ? 1 : 0;
+
+    int trim_left = std::max(
+        0, static_cast<int>(std::floor((left - hpad) * hscale)));
+    int trim_top =
+        std::max(0, static_cast<int>(std::floor((top - vpad) * vscale)));
+    int trim_right = std::min(
+        image_width,
+        static_cast<int>(std::ceil((left + width + hpad) * hscale)));
+    int trim_bottom = std::min(
+        image_height,
+        static_cast<int>(std::ceil((top + height + vpad) * vscale)));
 
     // Don't trim the height in toilet-roll mode
     if (query_->get<int>("n", 1) > 1) {
-        top = 0;
-        height = image.height();
+        trim_top = 0;
+        trim_bottom = image_height;
+    }
+
+    // Nothing to trim
+    if (trim_left == 0 && trim_top == 0 && trim_right == image_width &&
+        trim_bottom == image_height) {
+        return;
+    }
+
+    // Store the trim area relative to the source image
+    query_->update("trim_left", trim_left);
+    query_->update("trim_top", trim_top);
+    query_->update("trim_width", trim_right - trim_left);
+    query_->update("trim_height", trim_bottom - trim_top);
+    query_->update("trim_ref_width", image_width);
+    query_->update("trim_ref_height", image_height);
+
+    query_->update("trim", true);
+}
+
+std::tuple<int, int, int, int>
+Trim::resolve_extract(const int image_width, const int image_height) const {
+    // The image may have been shrunk on load after the trim area was found
+    double hscale = static_cast<double>(image_width) /
+                    static_cast<double>(query_->get<int>("trim_ref_width"));
+    double vscale = static_cast<double>(image_height) /
+                    static_cast<double>(query_->get<int>("trim_ref_height"));
+
+    auto trim_left = query_->get<int>("trim_left");
+    auto trim_top = query_->get<int>("trim_top");
+
+    int left = static_cast<int>(std::floor(trim_left * hscale));
+    int top = static_cast<int>(std::floor(trim_top * vscale));
+    int right = std::min(
+        image_width,
+        static_cast<int>(std::ceil(
+            (trim_left + query_->get<int>("trim_width")) * hscale)));
+    int bottom = std::min(
+        image_height,
+        static_cast<int>(std::ceil(
+            (trim_top + query_->get<int>("trim_height")) * vscale)));
+
+    return std::make_tuple(left, top, std::max(1, right - left),
+                           std::max(1, bottom - top));
+}
+
+VImage Trim::process(const VImage &image) const {
+    // Make sure that trimming is required
+    if (!query_->get<bool>("trim", false)) {
+        return image;
     }
 
-    // And crop the original image
+    int left, top, width, height;
+    std::tie(left, top, width, height) =
+        resolve_extract(image.width(), image.height());
+
+    // And crop the image
     return image.extract_area(left, top, width, height);
 }
 
@@ -1,18 +1,66 @@
 #pragma once
 
+#include "io/source.h"
 #include "processors/base.h"
 
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <tuple>
 #include <vector>
 
 namespace weserv {
 namespace api {
 namespace processors {
 
+/**
+ * Load a thumbnail of the source, which renders the same pages as the image
+ * being processed (if the loader supports this). Used for the previews and
+ * proxies that are searched instead of the (sequential) source image.
+ * @param query Query holder.
+ * @param source Source to read from.
+ * @param width Maximum width of the thumbnail.
+ * @param height Maximum height of a page of the thumbnail.
+ * @return The thumbnail image.
+ */
+VImage new_page_thumbnail(const parsers::QueryHolderPtr &query,
+                          const io::Source &source, int width, int height);
+
 class Trim : ImageProcessor {
  public:
     using ImageProcessor::ImageProcessor;
 
+    /**
+     * Find the trim area on a shrunk preview of the source and store it in
+     * the query map. This doesn't touch the (sequential) source image, the
+     * actual crop is done within `process`.
+     * @param image The source image.
+     * @param source Source to read from.
+     */
+    void resolve_area(const VImage &image, const io::Source &source) const;
+
+    /**
+     * Scale the stored trim area to an image with the given dimensions, which
+     * may have been shrunk on load after the trim area was found.
+     * @param image_width Width of the image.
+     * @param image_height Height of the image.
+     * @return The left, top, width and height of the trim area.
+     */
+    std::tuple<int, int, int, int> resolve_extract(int image_width,
+                                                   int image_height) const;
+
     VImage process(const VImage &image) const override;
+
+ private:
+    /**
+     * Load a shrunk preview of the source, which is used for finding the
+     * trim area. The preview is never shrunk more than the output image will
+     * be, so that the scaled up trim area is accurate within one output pixel.
+     * @param image The source image.
+     * @param source Source to read from.
+     * @return The preview image.
+     */
+    VImage new_preview(const VImage &image, const io::Source &source) const;
 };
 
 }  // namespace processors
@@ -0,0 +1,88 @@
+#include "utils/cache.h"
+
+#include <algorithm>
+#include <array>
+#include <list>
+
+namespace weserv {
+namespace api {
+namespace utils {
+
+// Operations whose constant images may be cached. Small matrices (like the
+// 3x3 convolution masks and recombination matrices) are cheaper to build
+// than to look up, so these are not cached.
+const std::array<const char *, 1> CACHEABLE_OPERATIONS = {
+    "maplut"  // Lookup tables
+};
+
+// Maximum number of images kept per worker
+const size_t MAX_CACHED_IMAGES = 64;
+
+// Maximum memory used by the cached images per worker (= 1 MiB)
+const size_t MAX_CACHE_MEMORY = 1024 * 1024;
+
+struct CachedImage {
+    std::string operation;
+    std::vector<double> params;
+    VImage image;
+    size_t memory;
+};
+
+// Cached images, most recently used first
+thread_local std::list<CachedImage> image_cache;
+
+thread_local CacheStats stats = {0, 0, 0, 0};
+
+VImage cached_image(const std::string &operation,
+                    const std::vector<double> &params,
+                    const std::function<VImage()> &build) {
+    if (std::find(CACHEABLE_OPERATIONS.begin(), CACHEABLE_OPERATIONS.end(),
+                  operation) == CACHEABLE_OPERATIONS.end()) {
+        return build();
+    }
+
+    ++stats.lookups;
+
+    for (auto it = image_cache.begin(); it != image_cache.end(); ++it) {
+        if (it->operation == operation && it->params == params) {
+            // Move to the front, it's the most recently used
+            image_cache.splice(image_cache.begin(), image_cache, it);
+
+            ++stats.hits;
+            return it->image;
+        }
+    }
+
+    // Render the image to memory, this ensures that nothing of the pipeline
+    // that produced it is kept alive
+    auto image = build().copy_memory();
+    auto memory =
+        static_cast<size_t>(VIPS_IMAGE_SIZEOF_IMAGE(image.get_image()));
+
+    // Too large to cache
+    if (memory > MAX_CACHE_MEMORY) {
+        return image;
+    }
+
+    image_cache.push_front({operation, params, image, memory});
+    stats.memory += memory;
+
+    // Evict the least recently used images
+    while (image_cache.size() > MAX_CACHED_IMAGES ||
+           stats.memory > MAX_CACHE_MEMORY) {
+        stats.memory -= image_cache.back().memory;
+        image_cache.pop_back();
+    }
+
+    stats.entries = image_cache.size();
+
+    return image;
+}
+
+CacheStats cache_stats() {
+    return stats;
+}
+
+}  // namespace utils
+}  // namespace api
+}  // namespace weserv
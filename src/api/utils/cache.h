@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <vips/vips8>
+
+namespace weserv {
+namespace api {
+namespace utils {
+
+using vips::VImage;
+
+/**
+ * Statistics of the constant image cache.
+ */
+struct CacheStats {
+    /**
+     * Number of lookups that were served from the cache.
+     */
+    uint64_t hits;
+
+    /**
+     * Total number of lookups of allowlisted operations.
+     */
+    uint64_t lookups;
+
+    /**
+     * Number of images currently cached.
+     */
+    size_t entries;
+
+    /**
+     * Memory used by the cached images, in bytes.
+     */
+    size_t memory;
+};
+
+/**
+ * Look up a small constant image (e.g. a LUT) in the per-worker cache,
+ * building and caching it on a miss. Only operations on the allowlist are
+ * cached, anything else is just built.
+ * Note: the cached image is shared between requests, so it must not be
+ * modified afterwards.
+ * @param operation The operation this image is used for, see the allowlist.
+ * @param params The parameters the image is derived from.
+ * @param build Function to build the image on a cache miss.
+ * @return The (cached) image.
+ */
+VImage cached_image(const std::string &operation,
+                    const std::vector<double> &params,
+                    const std::function<VImage()> &build);
+
+/**
+ * Get the statistics of the per-worker constant image cache.
+ * @return The cache statistics.
+ */
+CacheStats cache_stats();
+
+}  // namespace utils
+}  // namespace api
+}  // namespace weserv
@@ -0,0 +1,177 @@
+#include "utils/content.h"
+
+#include "utils/utility.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <unordered_set>
+
+namespace weserv {
+namespace api {
+namespace utils {
+
+using vips::VError;
+
+// Images are classified on a preview of (at most) 128x128 pixels
+const int PREVIEW_SIZE = 128;
+
+// Graphics have at most 256 distinct colours (with 5 bits per channel, to
+// ignore compression noise) ...
+const size_t MAX_GRAPHIC_COLOURS = 256;
+
+// ... and consist of flat areas with sharp edges. Neighbouring pixels that
+// differ between these values (summed over the channels) are texture, which
+// is found in less than 15% of the pixels of graphics.
+const int FLAT_DIFFERENCE = 12;
+const int EDGE_DIFFERENCE = 96;
+const double MAX_TEXTURE_RATIO = 0.15;
+
+// Images that meet only one of the above (smooth photos and anti-aliased
+// graphics are flat, but have many colours) are graphics if their lossless
+// preview is at most 1.5 times the size of the lossy one
+const double MAX_LOSSLESS_RATIO = 1.5;
+
+thread_local ContentStats stats = {0, 0, 0, 0, 0};
+
+namespace {
+
+/**
+ * Save the preview of a classified image to a buffer.
+ * @return The size of the formatted preview, in bytes.
+ */
+size_t preview_size(const VImage &preview, const Output &output) {
+    std::string extension = determine_image_extension(output);
+
+    void *buf;
+    size_t size;
+
+    preview.write_to_buffer(extension.c_str(), &buf, &size,
+                            VImage::option()->set("strip", true));
+
+    g_free(buf);
+
+    return size;
+}
+
+}  // namespace
+
+Content classify_content(const VImage &image) {
+    auto preview = image;
+
+    // Nearest neighbour, so that no new colours are introduced
+    double scale =
+        std::min(1.0, static_cast<double>(PREVIEW_SIZE) /
+                          std::max(preview.width(), preview.height()));
+    if (scale < 1.0) {
+        preview = preview.resize(
+            scale, VImage::option()->set("kernel", VIPS_KERNEL_NEAREST));
+    }
+
+    preview = preview.colourspace(VIPS_INTERPRETATION_sRGB);
+    if (preview.format() != VIPS_FORMAT_UCHAR) {
+        preview = preview.cast(VIPS_FORMAT_UCHAR);
+    }
+    if (preview.bands() > 4) {
+        preview = preview.extract_band(0, VImage::option()->set("n", 4));
+    }
+
+    preview = preview.copy_memory();
+
+    int bands = preview.bands();
+    bool has_alpha = bands == 4;
+    auto *data = static_cast<const uint8_t *>(preview.data());
+    size_t line_size = VIPS_IMAGE_SIZEOF_LINE(preview.get_image());
+
+    std::unordered_set<int> colours;
+    uint64_t comparisons = 0;
+    uint64_t texture = 0;
+    bool uses_alpha = false;
+
+    for (int y = 0; y < preview.height(); ++y) {
+        const uint8_t *p = data + y * line_size;
+
+        for (int x = 0; x < preview.width(); ++x, p += bands) {
+            if (has_alpha && p[3] != 255) {
+                uses_alpha = true;
+
+                // The colour of transparent pixels doesn't matter
+                if (p[3] == 0) {
+                    continue;
+                }
+            }
+
+            if (colours.size() <= MAX_GRAPHIC_COLOURS) {
+                colours.insert((p[0] >> 3) << 10 | (p[1] >> 3) << 5 |
+                               p[2] >> 3);
+            }
+
+            if (x > 0) {
+                int difference = std::abs(p[0] - p[-bands]) +
+                                 std::abs(p[1] - p[1 - bands]) +
+                                 std::abs(p[2] - p[2 - bands]);
+
+                ++comparisons;
+                if (difference > FLAT_DIFFERENCE &&
+                    difference < EDGE_DIFFERENCE) {
+                    ++texture;
+                }
+            }
+        }
+    }
+
+    bool few_colours = colours.size() <= MAX_GRAPHIC_COLOURS;
+    bool flat = static_cast<double>(texture) <
+                static_cast<double>(comparisons) * MAX_TEXTURE_RATIO;
+
+    bool graphic = few_colours && flat;
+    if (few_colours != flat) {
+        // Ambiguous, confirm on the size of the encoded previews
+        try {
+            auto lossless_bytes = preview_size(preview, Output::Png);
+            auto lossy_bytes = preview_size(preview, Output::Jpeg);
+
+            graphic = static_cast<double>(lossless_bytes) <=
+                      static_cast<double>(lossy_bytes) * MAX_LOSSLESS_RATIO;
+        } catch (const VError &) {
+            // Assume a photo, the lossy output is always the smallest
+            vips_error_clear();
+        }
+    }
+
+    return {graphic, uses_alpha, preview};
+}
+
+void record_content(const Content &content, const Output &origin,
+                    const Output &output) {
+    ++stats.classified;
+
+    if (content.graphic) {
+        ++stats.graphics;
+    }
+
+    if (origin == output) {
+        return;
+    }
+
+    ++stats.converted;
+
+    try {
+        auto origin_bytes = preview_size(content.preview, origin);
+        auto output_bytes = preview_size(content.preview, output);
+
+        stats.origin_bytes += origin_bytes;
+        stats.output_bytes += output_bytes;
+    } catch (const VError &) {
+        // The statistics are best effort, never fail the request on it
+        vips_error_clear();
+    }
+}
+
+ContentStats content_stats() {
+    return stats;
+}
+
+}  // namespace utils
+}  // namespace api
+}  // namespace weserv
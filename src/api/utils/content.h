@@ -0,0 +1,98 @@
+#pragma once
+
+#include "enums.h"
+
+#include <cstdint>
+
+#include <vips/vips8>
+
+namespace weserv {
+namespace api {
+namespace utils {
+
+using enums::Output;
+using vips::VImage;
+
+/**
+ * What a (single-page) image looks like, see `classify_content()`.
+ */
+struct Content {
+    /**
+     * Is this a graphic (few colours, flat areas with sharp edges) rather
+     * than a photo?
+     */
+    bool graphic;
+
+    /**
+     * Does the image have any (semi-)transparent pixels?
+     */
+    bool uses_alpha;
+
+    /**
+     * The shrunk preview the image was classified on, in sRGB.
+     */
+    VImage preview;
+};
+
+/**
+ * Statistics of the content-aware output selection.
+ */
+struct ContentStats {
+    /**
+     * Number of images that were classified.
+     */
+    uint64_t classified;
+
+    /**
+     * Number of images that were classified as graphic.
+     */
+    uint64_t graphics;
+
+    /**
+     * Number of images that were saved in another format than the origin.
+     */
+    uint64_t converted;
+
+    /**
+     * Size of the previews of the converted images, saved in the origin
+     * format, in bytes.
+     */
+    uint64_t origin_bytes;
+
+    /**
+     * Size of the previews of the converted images, saved in the selected
+     * format, in bytes.
+     */
+    uint64_t output_bytes;
+};
+
+/**
+ * Classify an image as photo or graphic on a shrunk preview. This looks at
+ * the number of colours, the differences between neighbouring pixels and the
+ * alpha usage. When only one of the first two looks like a graphic, the
+ * preview is encoded lossless and lossy to decide.
+ * @param image The (single-page) image to classify.
+ * @return What the image looks like.
+ */
+Content classify_content(const VImage &image);
+
+/**
+ * Record the output selected for a classified image. If it differs from the
+ * origin output, the preview is saved in both formats to estimate the bytes
+ * saved.
+ * @param content The classified image.
+ * @param origin The output which mirrors the origin format.
+ * @param output The selected output.
+ */
+void record_content(const Content &content, const Output &origin,
+                    const Output &output);
+
+/**
+ * Get the statistics of the content-aware output selection of this worker.
+ * @return The content statistics.
+ */
+ContentStats content_stats();
+
+}  // namespace utils
+}  // namespace api
+}  // namespace weserv
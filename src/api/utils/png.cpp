@@ -0,0 +1,380 @@
+#include "utils/png.h"
+
+#include "utils/utility.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+namespace weserv {
+namespace api {
+namespace utils {
+
+// Strips of rows are deflated separately, each about 1 MiB (uncompressed)
+const size_t STRIP_SIZE = 1024 * 1024;
+
+// The size of the deflate window, the maximum useful dictionary size
+const size_t WINDOW_SIZE = 32 * 1024;
+
+namespace {
+
+const uint8_t PNG_SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+struct Strip {
+    int first_row;
+    int rows;
+    std::string deflated;
+    uLong adler;
+};
+
+/**
+ * The helpers of a `parallel_for` call, which run on the shared thread pool.
+ */
+struct ParallelFor {
+    std::function<void()> worker;
+    std::mutex mutex;
+    std::condition_variable done;
+    int pending;
+};
+
+void run_helper(gpointer data, gpointer /* unused */) {
+    auto *task = static_cast<ParallelFor *>(data);
+
+    task->worker();
+
+    std::lock_guard<std::mutex> lock(task->mutex);
+    if (--task->pending == 0) {
+        task->done.notify_one();
+    }
+}
+
+/**
+ * The thread pool of the helpers. It's not exclusive, so the threads are
+ * shared with the other pools of the process and kept around while idle,
+ * rather than created for each image.
+ * @return The thread pool, or nullptr if it couldn't be created.
+ */
+GThreadPool *helper_pool() {
+    static GThreadPool *pool =
+        g_thread_pool_new(run_helper, nullptr, -1, FALSE, nullptr);
+
+    return pool;
+}
+
+/**
+ * Run a function for each index in [0, count) on the given number of threads
+ * (including the calling thread).
+ */
+void parallel_for(size_t count, int threads,
+                  const std::function<void(size_t)> &function) {
+    std::atomic<size_t> next(0);
+
+    ParallelFor task;
+    task.worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            function(i);
+        }
+    };
+    task.pending = 0;
+
+    GThreadPool *pool = helper_pool();
+    int helpers = pool != nullptr
+                      ? static_cast<int>(std::min<size_t>(threads, count)) - 1
+                      : 0;
+    if (helpers > 0) {
+        task.pending = helpers;
+        for (int i = 0; i < helpers; ++i) {
+            g_thread_pool_push(pool, &task, nullptr);
+        }
+    }
+
+    task.worker();
+
+    // The helpers refer to the task, wait until all of them are done
+    std::unique_lock<std::mutex> lock(task.mutex);
+    task.done.wait(lock, [&task]() { return task.pending == 0; });
+}
+
+void append_uint32(std::string *out, uint32_t value) {
+    out->push_back(static_cast<char>(value >> 24));
+    out->push_back(static_cast<char>(value >> 16));
+    out->push_back(static_cast<char>(value >> 8));
+    out->push_back(static_cast<char>(value));
+}
+
+void append_chunk(std::string *out, const char *type, const std::string &data) {
+    append_uint32(out, static_cast<uint32_t>(data.size()));
+
+    size_t start = out->size();
+    out->append(type, 4);
+    out->append(data);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(out->data() + start),
+                static_cast<uInt>(data.size() + 4));
+
+    append_uint32(out, static_cast<uint32_t>(crc));
+}
+
+uint8_t paeth_predictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return static_cast<uint8_t>(a);
+    }
+
+    return static_cast<uint8_t>(pb <= pc ? b : c);
+}
+
+/**
+ * Filter a row with the given PNG filter type.
+ * @param row The row, in PNG byte order.
+ * @param prev The row above it (all zeros for the first row).
+ * @param size The size of a row, in bytes.
+ * @param bpp The number of bytes per pixel (at least 1).
+ * @param type The filter type, 0 (none) - 4 (Paeth).
+ * @param out Output, the filter type followed by the filtered row.
+ */
+void filter_row(const uint8_t *row, const uint8_t *prev, size_t size,
+                size_t bpp, uint8_t type, uint8_t *out) {
+    out[0] = type;
+    ++out;
+
+    for (size_t i = 0; i < size; ++i) {
+        int a = i >= bpp ? row[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= bpp ? prev[i - bpp] : 0;
+
+        switch (type) {
+            case 1:  // Sub
+                out[i] = static_cast<uint8_t>(row[i] - a);
+                break;
+            case 2:  // Up
+                out[i] = static_cast<uint8_t>(row[i] - b);
+                break;
+            case 3:  // Average
+                out[i] = static_cast<uint8_t>(row[i] - (a + b) / 2);
+                break;
+            case 4:  // Paeth
+                out[i] = static_cast<uint8_t>(row[i] -
+                                              paeth_predictor(a, b, c));
+                break;
+            default:  // None
+                out[i] = row[i];
+        }
+    }
+}
+
+/**
+ * Filter a strip of rows into the filtered image data.
+ */
+void filter_strip(const VImage &image, const Strip &strip, size_t bpp,
+                  bool adaptive_filter, uint8_t *filtered) {
+    size_t row_size = VIPS_IMAGE_SIZEOF_LINE(image.get_image());
+    bool swap = image.format() == VIPS_FORMAT_USHORT && !vips_amiMSBfirst();
+    auto *data = static_cast<const uint8_t *>(image.data());
+
+    // Rows in PNG byte order (16-bit samples are big-endian, swapped only on
+    // little-endian hosts)
+    std::vector<uint8_t> row(row_size), prev(row_size, 0);
+    auto load_row = [&](int y, std::vector<uint8_t> *out) {
+        const uint8_t *p = data + y * row_size;
+        if (swap) {
+            for (size_t i = 0; i + 1 < row_size; i += 2) {
+                (*out)[i] = p[i + 1];
+                (*out)[i + 1] = p[i];
+            }
+        } else {
+            std::memcpy(out->data(), p, row_size);
+        }
+    };
+
+    if (strip.first_row > 0) {
+        load_row(strip.first_row - 1, &prev);
+    }
+
+    std::vector<uint8_t> candidate(row_size + 1);
+
+    for (int y = strip.first_row; y < strip.first_row + strip.rows; ++y) {
+        load_row(y, &row);
+
+        uint8_t *out = filtered + y * (row_size + 1);
+
+        if (!adaptive_filter) {
+            filter_row(row.data(), prev.data(), row_size, bpp, 0, out);
+        } else {
+            // Pick the filter with the minimum sum of absolute differences,
+            // the heuristic of libpng
+            uint64_t best_sum = UINT64_MAX;
+            for (uint8_t type = 0; type <= 4; ++type) {
+                filter_row(row.data(), prev.data(), row_size, bpp, type,
+                           candidate.data());
+
+                uint64_t sum = 0;
+                for (size_t i = 1; i <= row_size; ++i) {
+                    sum += std::abs(static_cast<int8_t>(candidate[i]));
+                }
+
+                if (sum < best_sum) {
+                    best_sum = sum;
+                    std::memcpy(out, candidate.data(), row_size + 1);
+                }
+            }
+        }
+
+        row.swap(prev);
+    }
+}
+
+/**
+ * Deflate a strip of the filtered image data as raw deflate data, primed with
+ * the data before it. All strips but the last end on a byte boundary (with a
+ * sync flush), so they can be concatenated.
+ */
+void deflate_strip(const std::string &filtered, size_t start, size_t length,
+                   int level, bool last, Strip *strip) {
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Unable to initialize deflate");
+    }
+
+    const auto *data = reinterpret_cast<const Bytef *>(filtered.data());
+
+    if (start > 0) {
+        size_t dictionary = std::min(start, WINDOW_SIZE);
+        deflateSetDictionary(&stream, data + start - dictionary,
+                             static_cast<uInt>(dictionary));
+    }
+
+    // A sync flush adds an empty stored block (at most 6 bytes)
+    strip->deflated.resize(deflateBound(&stream, length) + 16);
+
+    stream.next_in = const_cast<Bytef *>(data + start);
+    stream.avail_in = static_cast<uInt>(length);
+    stream.next_out = reinterpret_cast<Bytef *>(&strip->deflated[0]);
+    stream.avail_out = static_cast<uInt>(strip->deflated.size());
+
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    strip->deflated.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (result != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0) {
+        throw std::runtime_error("Unable to deflate the image data");
+    }
+
+    strip->adler = adler32(adler32(0L, Z_NULL, 0), data + start,
+                           static_cast<uInt>(length));
+}
+
+}  // namespace
+
+std::string save_png_parallel(const VImage &image, const int level,
+                              const bool adaptive_filter, const int threads) {
+    // Convert to something PNG can hold, as libvips does for pngsave
+    auto png = image;
+    bool is_16_bit = utils::is_16_bit(png.interpretation());
+    if (!is_16_bit && png.interpretation() != VIPS_INTERPRETATION_B_W &&
+        png.interpretation() != VIPS_INTERPRETATION_sRGB) {
+        png = png.colourspace(VIPS_INTERPRETATION_sRGB);
+    }
+    if (png.bands() > 4) {
+        png = png.extract_band(0, VImage::option()->set("n", 4));
+    }
+
+    png = png.cast(is_16_bit ? VIPS_FORMAT_USHORT : VIPS_FORMAT_UCHAR)
+              .copy_memory();
+
+    int bands = png.bands();
+    size_t bpp = static_cast<size_t>(bands) * (is_16_bit ? 2 : 1);
+    size_t row_size = VIPS_IMAGE_SIZEOF_LINE(png.get_image());
+
+    // Greyscale, greyscale with alpha, truecolour or truecolour with alpha
+    uint8_t colour_type = bands == 1 ? 0 : bands == 2 ? 4 : bands == 3 ? 2 : 6;
+
+    int rows_per_strip = static_cast<int>(
+        std::max<size_t>(1, STRIP_SIZE / (row_size + 1)));
+
+    std::vector<Strip> strips;
+    for (int y = 0; y < png.height(); y += rows_per_strip) {
+        strips.push_back(
+            {y, std::min(rows_per_strip, png.height() - y), "", 0});
+    }
+
+    // Filter the rows ...
+    std::string filtered(png.height() * (row_size + 1), '\0');
+    auto *filtered_data = reinterpret_cast<uint8_t *>(&filtered[0]);
+    parallel_for(strips.size(), threads, [&](size_t i) {
+        filter_strip(png, strips[i], bpp, adaptive_filter, filtered_data);
+    });
+
+    // ... and deflate each strip, primed with the strip before it
+    std::atomic<bool> failed(false);
+    parallel_for(strips.size(), threads, [&](size_t i) {
+        try {
+            deflate_strip(filtered, strips[i].first_row * (row_size + 1),
+                          strips[i].rows * (row_size + 1), level,
+                          i == strips.size() - 1, &strips[i]);
+        } catch (const std::runtime_error &) {
+            failed = true;
+        }
+    });
+
+    if (failed) {
+        throw std::runtime_error("Unable to deflate the image data");
+    }
+
+    std::string out(reinterpret_cast<const char *>(PNG_SIGNATURE),
+                    sizeof(PNG_SIGNATURE));
+
+    std::string header;
+    append_uint32(&header, static_cast<uint32_t>(png.width()));
+    append_uint32(&header, static_cast<uint32_t>(png.height()));
+    header.push_back(static_cast<char>(is_16_bit ? 16 : 8));
+    header.push_back(static_cast<char>(colour_type));
+    header.append(3, '\0');  // Deflate, adaptive filtering, no interlace
+    append_chunk(&out, "IHDR", header);
+
+    // The zlib header (with the compression level as hint), the concatenated
+    // strips and the combined checksum, one IDAT chunk per strip
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (size_t i = 0; i != strips.size(); ++i) {
+        std::string data;
+        if (i == 0) {
+            data.push_back(static_cast<char>(0x78));
+            data.push_back(static_cast<char>(
+                level < 2 ? 0x01 : level < 6 ? 0x5E : level == 6 ? 0x9C
+                                                                  : 0xDA));
+        }
+
+        data.append(strips[i].deflated);
+
+        adler = adler32_combine(adler, strips[i].adler,
+                                strips[i].rows * (row_size + 1));
+        if (i == strips.size() - 1) {
+            append_uint32(&data, static_cast<uint32_t>(adler));
+        }
+
+        append_chunk(&out, "IDAT", data);
+    }
+
+    append_chunk(&out, "IEND", "");
+
+    return out;
+}
+
+}  // namespace utils
+}  // namespace api
+}  // namespace weserv
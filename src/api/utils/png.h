@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include <vips/vips8>
+
+namespace weserv {
+namespace api {
+namespace utils {
+
+using vips::VImage;
+
+/**
+ * Save an image as (non-interlaced, truecolour or greyscale) PNG, deflating
+ * strips of rows on multiple threads. Each strip is primed with the last 32
+ * KiB of the strip before it, so the compression is close to a single zlib
+ * stream. The strips are concatenated into one valid zlib stream, like pigz
+ * does.
+ * @note The image is rendered to memory, this is meant for large outputs
+ *       where the single-threaded deflate of libpng dominates.
+ * @param image The image to save.
+ * @param level The zlib compression level, 0 - 9.
+ * @param adaptive_filter Choose the filter of each row adaptively, rather
+ *                        than not filtering at all.
+ * @param threads Number of threads to deflate on.
+ * @return The formatted image.
+ */
+std::string save_png_parallel(const VImage &image, int level,
+                              bool adaptive_filter, int threads);
+
+}  // namespace utils
+}  // namespace api
+}  // namespace weserv
@@ -164,12 +164,47 @@ inline std::string determine_image_extension(const Output &output) {
             return ".tiff";
         case Output::Gif:
             return ".gif";
+        case Output::Avif:
+            return ".avif";
+        case Output::Jxl:
+            return ".jxl";
         case Output::Png:
         default:
             return ".png";
     }
 }
 
+/**
+ * Is there a save operation available for this output?
+ * @param output The output enum.
+ * @return A bool indicating if this output is supported.
+ */
+inline bool is_output_supported(const Output &output) {
+#if !VIPS_VERSION_AT_LEAST(8, 9, 0)
+    // AV1 compression within HEIF is not supported before libvips 8.9.0
+    if (output == Output::Avif) {
+        return false;
+    }
+#endif
+
+    std::string extension = determine_image_extension(output);
+
+#if VIPS_VERSION_AT_LEAST(8, 10, 0)
+    bool supported =
+        vips_foreign_find_save_target(extension.c_str()) != nullptr;
+#else
+    bool supported =
+        vips_foreign_find_save_buffer(extension.c_str()) != nullptr;
+#endif
+
+    // The lookup sets an error message if nothing was found
+    if (!supported) {
+        vips_error_clear();
+    }
+
+    return supported;
+}
+
 /**
  * Determine the output from the image type enum.
  * @param image_type The image type enum.
@@ -185,6 +220,8 @@ inline Output to_output(const ImageType &image_type) {
             return Output::Tiff;
         case ImageType::Gif:
             return Output::Gif;
+        case ImageType::Jxl:
+            return Output::Jxl;
         case ImageType::Png:
         default:
             return Output::Png;
@@ -213,6 +250,8 @@ inline ImageType determine_image_type(const std::string &loader) {
         return ImageType::Pdf;
     } else if (loader.rfind("VipsForeignLoadHeif", 0) == 0) {
         return ImageType::Heif;
+    } else if (loader.rfind("VipsForeignLoadJxl", 0) == 0) {
+        return ImageType::Jxl;
     } else if (loader.rfind("VipsForeignLoadMagick", 0) == 0) {
         return ImageType::Magick;
     } else {  // LCOV_EXCL_START
@@ -235,6 +274,17 @@ inline bool image_loader_supports_page(const std::string &loader) {
            loader.rfind("VipsForeignLoadMagick", 0) == 0;
 }
 
+/**
+ * Does this image type support multiple pages?
+ * @param image_type Image type to check.
+ * @return A bool indicating if this image type support multiple pages.
+ */
+inline bool image_type_supports_page(const ImageType &image_type) {
+    return image_type == ImageType::Pdf || image_type == ImageType::Gif ||
+           image_type == ImageType::Tiff || image_type == ImageType::Webp ||
+           image_type == ImageType::Heif || image_type == ImageType::Magick;
+}
+
 /**
  * Provide a string identifier for the given image type.
  * @param image_type The image type enum.
@@ -258,6 +308,8 @@ inline std::string image_type_id(const ImageType &image_type) {
             return "pdf";
         case ImageType::Heif:
             return "heif";
+        case ImageType::Jxl:
+            return "jxl";
         case ImageType::Magick:
             return "magick";
         case ImageType::Unknown:  // LCOV_EXCL_START
@@ -274,7 +326,8 @@ inline std::string image_type_id(const ImageType &image_type) {
  */
 inline bool support_alpha_channel(const ImageType &image_type) {
     return image_type == ImageType::Png || image_type == ImageType::Webp ||
-           image_type == ImageType::Tiff || image_type == ImageType::Gif;
+           image_type == ImageType::Tiff || image_type == ImageType::Gif ||
+           image_type == ImageType::Jxl;
 }
 
 /**
@@ -408,6 +461,59 @@ inline std::string image_to_json(const VImage &image,
     return json.str();
 }
 
+/**
+ * Prepare an image for a comparison with `ssim()`. Only the luminance is
+ * compared, on a downscaled version of the image.
+ * @param image The image to prepare.
+ * @param width The width to downscale to.
+ * @return The prepared image, rendered to memory.
+ */
+inline VImage prepare_comparison(const VImage &image, const int width) {
+    auto luminance = image.colourspace(VIPS_INTERPRETATION_B_W)[0];
+    if (luminance.width() > width) {
+        luminance = luminance.resize(static_cast<double>(width) /
+                                     luminance.width());
+    }
+
+    // Compare 16-bit images in the 8-bit range
+    if (is_16_bit(luminance.interpretation())) {
+        return (luminance / 256.0).copy_memory();
+    }
+
+    return luminance.cast(VIPS_FORMAT_FLOAT).copy_memory();
+}
+
+/**
+ * Calculate the mean structural similarity (SSIM) of two images. Both
+ * images must be prepared with `prepare_comparison()`.
+ * See: https://en.wikipedia.org/wiki/Structural_similarity
+ * @param x The reference image.
+ * @param y The image to compare.
+ * @return The similarity, in the range of -1 - 1 (identical).
+ */
+inline double ssim(const VImage &x, const VImage &y) {
+    // Stabilize the division with a weak denominator (for 8-bit values)
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+
+    auto blur = [](const VImage &image) { return image.gaussblur(1.5); };
+
+    auto mu_x = blur(x);
+    auto mu_y = blur(y);
+    auto mu_x_mu_y = mu_x * mu_y;
+    auto mu_x_sq = mu_x * mu_x;
+    auto mu_y_sq = mu_y * mu_y;
+
+    auto sigma_x_sq = blur(x * x) - mu_x_sq;
+    auto sigma_y_sq = blur(y * y) - mu_y_sq;
+    auto sigma_xy = blur(x * y) - mu_x_mu_y;
+
+    auto ssim_map = ((2 * mu_x_mu_y + c1) * (2 * sigma_xy + c2)) /
+                    ((mu_x_sq + mu_y_sq + c1) * (sigma_x_sq + sigma_y_sq + c2));
+
+    return ssim_map.avg();
+}
+
 /**
  * Escape a string by replacing certain special characters.
  * @param s The string to escape.
@@ -0,0 +1,165 @@
+#include "base64.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WESERV_HAVE_SSSE3 1
+#include <immintrin.h>
+#endif
+
+namespace weserv {
+namespace nginx {
+
+namespace {
+
+const uint8_t BASE64_ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Encode a group of three bytes to four characters.
+ */
+inline void encode_base64_group(const uint8_t *src, uint8_t *dst) {
+    uint32_t group = src[0] << 16 | src[1] << 8 | src[2];
+
+    dst[0] = BASE64_ALPHABET[(group >> 18) & 0x3f];
+    dst[1] = BASE64_ALPHABET[(group >> 12) & 0x3f];
+    dst[2] = BASE64_ALPHABET[(group >> 6) & 0x3f];
+    dst[3] = BASE64_ALPHABET[group & 0x3f];
+}
+
+#ifdef WESERV_HAVE_SSSE3
+/**
+ * Encode four groups (12 bytes) at a time, see:
+ * http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+ * Note: 16 bytes are loaded, so at least 4 bytes of the input should follow
+ * the last groups.
+ * @return The number of bytes written to dst.
+ */
+__attribute__((target("ssse3"))) size_t
+encode_base64_groups_ssse3(const uint8_t *src, size_t length, uint8_t *dst) {
+    // Spread the 12 bytes over four 32-bit lanes of 3 bytes (as big-endian
+    // 16-bit words), so that the 6-bit indices can be shifted in place
+    const __m128i shuffle =
+        _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+
+    // Add the offset of the range that each index falls in
+    const __m128i offsets =
+        _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    uint8_t *p = dst;
+
+    for (/* void */; length >= 16; src += 12, length -= 12, p += 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        in = _mm_shuffle_epi8(in, shuffle);
+
+        // Extract the 6-bit indices of each lane
+        __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(t1, t3);
+
+        // Map the indices to their range (0 is a-z, 1 - 10 are the digits,
+        // 11 is +, 12 is / and 13 is A-Z)
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+        __m128i out =
+            _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p), out);
+    }
+
+    return (p - dst) + encode_base64_groups_scalar(src, length, p);
+}
+
+/**
+ * Does the CPU support SSSE3?
+ */
+bool has_ssse3() {
+    static const bool supported = __builtin_cpu_supports("ssse3") != 0;
+    return supported;
+}
+#endif
+
+}  // namespace
+
+size_t encode_base64_groups_scalar(const uint8_t *src, size_t length,
+                                   uint8_t *dst) {
+    uint8_t *p = dst;
+
+    for (/* void */; length >= 3; src += 3, length -= 3, p += 4) {
+        encode_base64_group(src, p);
+    }
+
+    return p - dst;
+}
+
+size_t encode_base64_groups(const uint8_t *src, size_t length, uint8_t *dst) {
+#ifdef WESERV_HAVE_SSSE3
+    if (has_ssse3()) {
+        return encode_base64_groups_ssse3(src, length, dst);
+    }
+#endif
+
+    return encode_base64_groups_scalar(src, length, dst);
+}
+
+size_t Base64Encoder::encode(const uint8_t *src, size_t length,
+                             uint8_t *dst) {
+    uint8_t *p = dst;
+
+    // Complete the group held back from the previous part
+    if (pending_ != 0) {
+        while (pending_ < 2 && length != 0) {
+            remainder_[pending_++] = *src++;
+            --length;
+        }
+
+        if (length == 0) {
+            return 0;
+        }
+
+        uint8_t group[3] = {remainder_[0], remainder_[1], *src++};
+        --length;
+        pending_ = 0;
+
+        encode_base64_group(group, p);
+        p += 4;
+    }
+
+    size_t size = encode_base64_groups(src, length, p);
+    p += size;
+    src += size / 4 * 3;
+    length -= size / 4 * 3;
+
+    while (length != 0) {
+        remainder_[pending_++] = *src++;
+        --length;
+    }
+
+    return p - dst;
+}
+
+size_t Base64Encoder::finish(uint8_t *dst) {
+    if (pending_ == 0) {
+        return 0;
+    }
+
+    uint32_t group = remainder_[0] << 16;
+    if (pending_ == 2) {
+        group |= remainder_[1] << 8;
+    }
+
+    dst[0] = BASE64_ALPHABET[(group >> 18) & 0x3f];
+    dst[1] = BASE64_ALPHABET[(group >> 12) & 0x3f];
+    dst[2] = pending_ == 2 ? BASE64_ALPHABET[(group >> 6) & 0x3f] : '=';
+    dst[3] = '=';
+
+    pending_ = 0;
+
+    return 4;
+}
+
+}  // namespace nginx
+}  // namespace weserv
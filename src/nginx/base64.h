@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace weserv {
+namespace nginx {
+
+/**
+ * Encode the complete groups of three bytes of the input, with SSSE3 if the
+ * CPU supports it (checked once, at runtime).
+ * @return The number of bytes written to dst (`length / 3 * 4`).
+ */
+size_t encode_base64_groups(const uint8_t *src, size_t length, uint8_t *dst);
+
+/**
+ * The portable implementation of `encode_base64_groups()`.
+ */
+size_t encode_base64_groups_scalar(const uint8_t *src, size_t length,
+                                   uint8_t *dst);
+
+/**
+ * A base64 encoder that is fed the output in parts, so that it can be encoded
+ * while it's produced.
+ */
+class Base64Encoder {
+ public:
+    /**
+     * Get the size of the encoded output of the next part (excluding the
+     * padding written by `finish()`).
+     */
+    size_t encoded_length(size_t length) const {
+        return (pending_ + length) / 3 * 4;
+    }
+
+    /**
+     * Get the number of bytes (0 - 2) held back until the next part.
+     */
+    size_t pending() const {
+        return pending_;
+    }
+
+    /**
+     * Encode the next part of the output. The bytes that don't fill a group
+     * of three are held back until the next part.
+     * @return The number of bytes written to dst (see `encoded_length()`).
+     */
+    size_t encode(const uint8_t *src, size_t length, uint8_t *dst);
+
+    /**
+     * Encode the bytes held back, with padding.
+     * @return The number of bytes written to dst (0 or 4).
+     */
+    size_t finish(uint8_t *dst);
+
+ private:
+    uint8_t remainder_[2];
+    size_t pending_ = 0;
+};
+
+}  // namespace nginx
+}  // namespace weserv
@@ -3,6 +3,7 @@
 #include "alloc.h"
 #include "error.h"
 #include "http.h"
+#include "stream.h"
 #include "uri_parser.h"
 #include "util.h"
 
@@ -11,6 +12,333 @@ using ::weserv::api::utils::Status;
 namespace weserv {
 namespace nginx {
 
+namespace {
+
+/**
+ * Open the requested file through the open file cache.
+ * @return NGX_OK, or the HTTP status code to finalize the request with.
+ */
+ngx_int_t ngx_weserv_open_file(ngx_http_request_t *r,
+                               ngx_open_file_info_t *of) {
+    ngx_str_t path;
+    size_t root;
+
+    u_char *last = ngx_http_map_uri_to_path(r, &path, &root, 0);
+    if (last == nullptr) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    path.len = last - path.data;
+
+    auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_http_core_module));
+
+    ngx_memzero(of, sizeof(ngx_open_file_info_t));
+
+    of->read_ahead = clcf->read_ahead;
+    of->directio = NGX_OPEN_FILE_DIRECTIO_OFF;
+    of->valid = clcf->open_file_cache_valid;
+    of->min_uses = clcf->open_file_cache_min_uses;
+    of->errors = clcf->open_file_cache_errors;
+    of->events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &path, of) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, of, r->pool) !=
+        NGX_OK) {
+        ngx_int_t rc;
+
+        // Same as the static module
+        switch (of->err) {
+            case 0:
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            case NGX_ENOENT:
+            case NGX_ENOTDIR:
+            case NGX_ENAMETOOLONG:
+                rc = NGX_HTTP_NOT_FOUND;
+                break;
+            case NGX_EACCES:
+#if (NGX_HAVE_OPENAT)
+            case NGX_EMLINK:
+            case NGX_ELOOP:
+#endif
+                rc = NGX_HTTP_FORBIDDEN;
+                break;
+            default:
+                rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+                break;
+        }
+
+        if (rc != NGX_HTTP_NOT_FOUND || clcf->log_not_found) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, of->err,
+                          "%s \"%s\" failed", of->failed, path.data);
+        }
+
+        return rc;
+    }
+
+    if (!of->is_file) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    return NGX_OK;
+}
+
+/**
+ * Does the entity tag of the response match the given header? This is the
+ * same as ngx_http_test_if_match of the not modified filter.
+ */
+bool ngx_weserv_test_if_match(ngx_http_request_t *r, ngx_table_elt_t *header,
+                              bool weak) {
+    ngx_table_elt_t *etag = r->headers_out.etag;
+    if (etag == nullptr) {
+        return false;
+    }
+
+    if (header->value.len == 1 && header->value.data[0] == '*') {
+        return true;
+    }
+
+    u_char *tag = etag->value.data;
+    size_t len = etag->value.len;
+
+    if (weak && len > 2 && tag[0] == 'W' && tag[1] == '/') {
+        tag += 2;
+        len -= 2;
+    }
+
+    u_char *start = header->value.data;
+    u_char *end = header->value.data + header->value.len;
+
+    while (start < end) {
+        if (weak && end - start > 2 && start[0] == 'W' && start[1] == '/') {
+            start += 2;
+        }
+
+        if (len > static_cast<size_t>(end - start)) {
+            return false;
+        }
+
+        if (ngx_strncmp(start, tag, len) == 0) {
+            start += len;
+
+            while (start < end && (*start == ' ' || *start == '\t')) {
+                ++start;
+            }
+
+            if (start == end || *start == ',') {
+                return true;
+            }
+        }
+
+        // Skip to the next entity tag
+        while (start < end && *start != ',') {
+            ++start;
+        }
+
+        while (start < end &&
+               (*start == ' ' || *start == '\t' || *start == ',')) {
+            ++start;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Set the entity tag of the response. That of the file (like the static
+ * module) is extended with a hash of the built query, since the image
+ * differs for each query, output format negotiated with the Accept request
+ * header and setting of this location.
+ */
+ngx_int_t ngx_weserv_set_etag(ngx_http_request_t *r, const std::string &query) {
+    if (ngx_http_set_etag(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    // Disabled with `etag off`
+    ngx_table_elt_t *etag = r->headers_out.etag;
+    if (etag == nullptr) {
+        return NGX_OK;
+    }
+
+    uint32_t hash = ngx_crc32_long(
+        reinterpret_cast<u_char *>(const_cast<char *>(query.data())),
+        query.size());
+
+    // "<mtime>-<size>" becomes "<mtime>-<size>-<hash>"
+    auto *value = reinterpret_cast<u_char *>(
+        ngx_pnalloc(r->pool, etag->value.len + sizeof("-00000000") - 1));
+    if (value == nullptr) {
+        return NGX_ERROR;
+    }
+
+    etag->value.len = ngx_sprintf(value, "%*s-%08xD\"", etag->value.len - 1,
+                                  etag->value.data, hash) -
+                      value;
+    etag->value.data = value;
+
+    return NGX_OK;
+}
+
+/**
+ * Does the If-Match or If-Unmodified-Since precondition fail? The same as
+ * the not modified filter, which the response of this handler passes by
+ * (it's sent to the next header filter of this module).
+ */
+bool ngx_weserv_precondition_failed(ngx_http_request_t *r) {
+    ngx_http_headers_in_t &in = r->headers_in;
+
+    if (r != r->main || r->disable_not_modified) {
+        return false;
+    }
+
+    if (in.if_unmodified_since != nullptr) {
+        time_t iums = ngx_parse_http_time(in.if_unmodified_since->value.data,
+                                          in.if_unmodified_since->value.len);
+
+        if (iums < r->headers_out.last_modified_time) {
+            return true;
+        }
+    }
+
+    return in.if_match != nullptr &&
+           !ngx_weserv_test_if_match(r, in.if_match, false);
+}
+
+/**
+ * Would the not modified filter respond with 304 Not Modified? Checked
+ * before the image is processed, since a 304 response doesn't need it.
+ */
+bool ngx_weserv_not_modified(ngx_http_request_t *r) {
+    ngx_http_headers_in_t &in = r->headers_in;
+
+    if (r != r->main || r->disable_not_modified ||
+        (in.if_modified_since == nullptr && in.if_none_match == nullptr)) {
+        return false;
+    }
+
+    if (in.if_modified_since != nullptr) {
+        auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+            ngx_http_get_module_loc_conf(r, ngx_http_core_module));
+
+        if (clcf->if_modified_since == NGX_HTTP_IMS_OFF) {
+            return false;
+        }
+
+        time_t ims = ngx_parse_http_time(in.if_modified_since->value.data,
+                                         in.if_modified_since->value.len);
+        time_t last_modified = r->headers_out.last_modified_time;
+
+        if (ims != last_modified &&
+            (clcf->if_modified_since == NGX_HTTP_IMS_EXACT ||
+             ims < last_modified)) {
+            return false;
+        }
+    }
+
+    return in.if_none_match == nullptr ||
+           ngx_weserv_test_if_match(r, in.if_none_match, true);
+}
+
+/**
+ * Process a local file (`weserv_mode file`). libvips reads the (cached) file
+ * descriptor directly, rather than the file being read into buffers by the
+ * static module and copied by the body filter.
+ */
+ngx_int_t ngx_weserv_file_handler(ngx_http_request_t *r,
+                                  ngx_weserv_loc_conf_t *lc) {
+    // Leave directories to the index and static modules
+    if (r->uri.data[r->uri.len - 1] == '/') {
+        return NGX_DECLINED;
+    }
+
+    // Discard request body, since we don't need it here
+    ngx_int_t rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_open_file_info_t of;
+    rc = ngx_weserv_open_file(r, &of);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    std::string query = ngx_weserv_build_query(r, lc);
+
+    // Validators of the image, see ngx_weserv_set_etag
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.last_modified_time = of.mtime;
+    r->headers_out.content_length_n = of.size;
+
+    if (ngx_weserv_set_etag(r, query) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->headers_out.content_length_n = -1;
+
+    if (ngx_weserv_precondition_failed(r)) {
+        return NGX_HTTP_PRECONDITION_FAILED;
+    }
+
+    // Unmodified, respond without processing the image (the not modified
+    // filter turns this into a 304 response)
+    if (ngx_weserv_not_modified(r)) {
+        set_cache_headers(r);
+
+        rc = ngx_http_send_header(r);
+
+        // The not modified filter disagreed, there's no body to send
+        if (rc == NGX_OK && !r->header_only) {
+            return NGX_ERROR;
+        }
+
+        return rc;
+    }
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+#if (NGX_THREADS)
+    if (NgxStream::is_possible(r, lc)) {
+        ngx_fd_t fd = of.fd;
+
+        return NgxStream::post(
+            r, lc,
+            [mc, query, fd](std::unique_ptr<api::io::TargetInterface> target) {
+                return mc->weserv->process_descriptor(query, fd,
+                                                      std::move(target));
+            });
+    }
+#endif
+
+    ngx_chain_t *out = nullptr;
+    Status status = mc->weserv->process_descriptor(
+        query, of.fd,
+        std::unique_ptr<api::io::TargetInterface>(new NgxTarget(r, &out)));
+
+    // Without a module context, the body filter sends the headers as well
+    if (status.ok()) {
+        return ngx_http_output_filter(r, out);
+    }
+
+    // The validators of the file don't apply to the error
+    ngx_http_clear_last_modified(r);
+    ngx_http_clear_etag(r);
+
+    ngx_chain_t error;
+    if (ngx_weserv_return_error(r, status, &error) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_output_filter(r, &error);
+}
+
+}  // namespace
+
 ngx_int_t ngx_weserv_request_handler(ngx_http_request_t *r) {
     auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
         ngx_http_get_module_loc_conf(r, ngx_weserv_module));
@@ -25,18 +353,7 @@ ngx_int_t ngx_weserv_request_handler(ngx_http_request_t *r) {
     }
 
     if (lc->mode == NGX_WESERV_FILE_MODE) {
-        // Allocate a weserv base module context
-        auto *ctx = register_pool_cleanup(r->pool, new (r->pool)
-                                                       ngx_weserv_base_ctx_t());
-
-        if (ctx == nullptr) {
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
-        }
-
-        // Set the request's weserv module context
-        ngx_http_set_ctx(r, ctx, ngx_weserv_module);
-
-        return NGX_DECLINED;
+        return ngx_weserv_file_handler(r, lc);
     }
 
     // Discard request body, since we don't need it here
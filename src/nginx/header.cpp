@@ -11,6 +11,9 @@ const u_char CONTENT_DISPOSITION_LOWCASE[] = "content-disposition";
 const ngx_str_t LOCATION = ngx_string("Location");
 const u_char LOCATION_LOWCASE[] = "location";
 
+const ngx_str_t VARY = ngx_string("Vary");
+const u_char VARY_LOWCASE[] = "vary";
+
 ngx_int_t set_expires_header(ngx_http_request_t *r, time_t max_age) {
     ngx_table_elt_t *e = r->headers_out.expires;
     if (e == nullptr) {
@@ -147,5 +150,22 @@ ngx_int_t set_location_header(ngx_http_request_t *r, ngx_str_t *value) {
     return NGX_OK;
 }
 
+ngx_int_t set_vary_header(ngx_http_request_t *r, ngx_str_t *value) {
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == nullptr) {
+        return NGX_ERROR;
+    }
+
+    h->key = VARY;
+    h->lowcase_key = const_cast<u_char *>(VARY_LOWCASE);
+    h->hash = ngx_hash_key(const_cast<u_char *>(VARY_LOWCASE),
+                           sizeof(VARY_LOWCASE) - 1);
+
+    h->value = *value;
+
+    return NGX_OK;
+}
+
 }  // namespace nginx
 }  // namespace weserv
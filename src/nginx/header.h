@@ -19,5 +19,7 @@ ngx_int_t set_content_disposition_header(ngx_http_request_t *r,
 
 ngx_int_t set_location_header(ngx_http_request_t *r, ngx_str_t *value);
 
+ngx_int_t set_vary_header(ngx_http_request_t *r, ngx_str_t *value);
+
 }  // namespace nginx
 }  // namespace weserv
@@ -462,6 +462,18 @@ ngx_int_t ngx_weserv_upstream_process_header(ngx_http_request_t *r) {
                 u->headers_in.chunked = 1;
             }
 
+            // Check if the origin is going to close the connection
+            static ngx_str_t connection = ngx_string("Connection");
+            static ngx_str_t close_token = ngx_string("close");
+            if (name.len == connection.len &&
+                ngx_strncasecmp(name.data, connection.data,
+                                connection.len) == 0 &&
+                ngx_strlcasestrn(value.data, value.data + value.len,
+                                 close_token.data,
+                                 close_token.len - 1) != nullptr) {
+                u->headers_in.connection_close = 1;
+            }
+
             // Check if there was a redirection URI
             static ngx_str_t location = ngx_string("Location");
             if (ctx->redirecting && name.len == location.len &&
@@ -649,6 +661,26 @@ Status initialize_upstream_request(ngx_http_request_t *r,
         return status;
     }
 
+    // The origin is connected to through ngx_weserv_upstream_init_peer()
+    // rather than by NGINX itself, so that idle keepalive connections and
+    // SSL sessions can be reused. Its host name is resolved in
+    // ngx_weserv_send_http_request().
+    ctx->resolved = u->resolved;
+    u->resolved = nullptr;
+
+    ngx_http_upstream_resolved_t *ur = ctx->resolved;
+
+    auto *origin = reinterpret_cast<u_char *>(
+        ngx_pnalloc(r->pool, u->schema.len + ur->host.len + NGX_INT_T_LEN + 1));
+    if (origin == nullptr) {
+        return Status(NGX_ERROR, "Out of memory");
+    }
+
+    ctx->origin.data = origin;
+    ctx->origin.len = ngx_sprintf(origin, "%V%V:%ui", &u->schema, &ur->host,
+                                  static_cast<ngx_uint_t>(ur->port)) -
+                      origin;
+
     u->output.tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
 
     auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
@@ -696,6 +728,25 @@ ngx_int_t ngx_weserv_send_http_request(ngx_http_request_t *r,
 
     Status status = initialize_upstream_request(r, ctx);
 
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    // Resolve the host name of the origin first, unless it's an IP address
+    // or there's an idle keepalive connection to it
+    if (status.ok() && ctx->resolved->sockaddr == nullptr) {
+        if (ngx_weserv_keepalive_has_connection(mc->keepalive_cache,
+                                                ctx->origin)) {
+            // Neither resolved nor looked up in the resolver cache
+            ngx_str_set(&ctx->resolve_status, "KEEPALIVE");
+        } else {
+            status = ngx_weserv_resolve(r, ctx);
+
+            if (status.ok()) {
+                return NGX_DONE;
+            }
+        }
+    }
+
     if (status.ok()) {
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "weserv: calling ngx_http_upstream_init(%p)", r);
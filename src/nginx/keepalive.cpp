@@ -0,0 +1,581 @@
+#include "keepalive.h"
+
+#include "module.h"
+
+namespace weserv {
+namespace nginx {
+
+// The maximum length of an origin; a host name (at most 253 characters),
+// along with the scheme and port
+const size_t MAX_ORIGIN_LENGTH = 272;
+
+// The number of SSL sessions cached per worker process
+const ngx_uint_t SSL_SESSIONS = 256;
+
+namespace {
+
+/**
+ * An idle keepalive connection to an origin server.
+ */
+struct ngx_weserv_keepalive_item_t {
+    ngx_queue_t queue;
+
+    ngx_weserv_keepalive_t *keepalive;
+
+    ngx_connection_t *connection;
+
+    socklen_t socklen;
+    ngx_sockaddr_t sockaddr;
+
+    size_t origin_len;
+    u_char origin[MAX_ORIGIN_LENGTH];
+};
+
+#if NGX_HTTP_SSL
+/**
+ * The SSL session of an origin server.
+ */
+struct ngx_weserv_ssl_session_item_t {
+    ngx_queue_t queue;
+
+    ngx_ssl_session_t *session;
+
+    size_t origin_len;
+    u_char origin[MAX_ORIGIN_LENGTH];
+};
+#endif
+
+/**
+ * The peer of an upstream request.
+ */
+struct ngx_weserv_upstream_peer_data_t {
+    ngx_weserv_keepalive_t *keepalive;
+
+    ngx_http_upstream_t *upstream;
+
+    /**
+     * The origin and its resolved addresses (with the port set).
+     */
+    ngx_str_t origin;
+    ngx_addr_t *addrs;
+    ngx_uint_t naddrs;
+
+    /**
+     * The next address to connect to.
+     */
+    ngx_uint_t current;
+
+    /**
+     * The address of a cached connection, connected to anew if the cached
+     * connection turns out to be closed and nothing was resolved.
+     */
+    ngx_addr_t cached_addr;
+    ngx_sockaddr_t cached_sockaddr;
+
+    unsigned tried_cache : 1;
+};
+
+}  // namespace
+
+struct ngx_weserv_keepalive_t {
+    ngx_msec_t timeout;
+
+    /**
+     * The idle connections (most recently used first), and the unused items.
+     */
+    ngx_queue_t cache;
+    ngx_queue_t free;
+
+#if NGX_HTTP_SSL
+    /**
+     * The SSL sessions (most recently used first), and the unused items.
+     */
+    ngx_queue_t sessions;
+    ngx_queue_t free_sessions;
+#endif
+};
+
+namespace {
+
+bool ngx_weserv_origin_equal(const u_char *origin, size_t origin_len,
+                             const ngx_str_t &other) {
+    return origin_len == other.len &&
+           ngx_memcmp(origin, other.data, other.len) == 0;
+}
+
+/**
+ * Reference: ngx_http_upstream_keepalive_close
+ */
+void ngx_weserv_keepalive_close(ngx_connection_t *c) {
+#if NGX_HTTP_SSL
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        if (ngx_ssl_shutdown(c) == NGX_AGAIN) {
+            c->ssl->handler = ngx_weserv_keepalive_close;
+            return;
+        }
+    }
+#endif
+
+    ngx_destroy_pool(c->pool);
+    ngx_close_connection(c);
+}
+
+void ngx_weserv_keepalive_dummy_handler(ngx_event_t *ev) {
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "weserv keepalive dummy handler");
+}
+
+/**
+ * Close an idle connection once the origin server closes it, sends
+ * something unexpected or the keepalive timeout expires.
+ * Reference: ngx_http_upstream_keepalive_close_handler
+ */
+void ngx_weserv_keepalive_close_handler(ngx_event_t *ev) {
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "weserv keepalive close handler");
+
+    auto *c = reinterpret_cast<ngx_connection_t *>(ev->data);
+
+    if (!c->close && !c->read->timedout) {
+        char buf[1];
+        ssize_t n = recv(c->fd, buf, 1, MSG_PEEK);
+
+        if (n == -1 && ngx_socket_errno == NGX_EAGAIN) {
+            ev->ready = 0;
+
+            if (ngx_handle_read_event(c->read, 0) == NGX_OK) {
+                return;
+            }
+        }
+    }
+
+    auto *item = reinterpret_cast<ngx_weserv_keepalive_item_t *>(c->data);
+
+    ngx_weserv_keepalive_close(c);
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->keepalive->free, &item->queue);
+}
+
+/**
+ * Cache the connection of a finished upstream request, if it can be reused.
+ * Reference: ngx_http_upstream_free_keepalive_peer
+ */
+void ngx_weserv_keepalive_save(ngx_weserv_upstream_peer_data_t *pd,
+                               ngx_peer_connection_t *pc,
+                               ngx_uint_t state) {
+    ngx_weserv_keepalive_t *keepalive = pd->keepalive;
+    ngx_connection_t *c = pc->connection;
+
+    if (ngx_queue_empty(&keepalive->cache) &&
+        ngx_queue_empty(&keepalive->free)) {
+        return;  // Disabled
+    }
+
+    if (state & NGX_PEER_FAILED || c == nullptr || c->read->eof ||
+        c->read->error || c->read->timedout || c->write->error ||
+        c->write->timedout) {
+        return;
+    }
+
+    if (!pd->upstream->keepalive || ngx_terminate || ngx_exiting) {
+        return;
+    }
+
+    if (pd->origin.len > MAX_ORIGIN_LENGTH) {
+        return;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "weserv keepalive: saving connection %p", c);
+
+    ngx_weserv_keepalive_item_t *item;
+    ngx_queue_t *q;
+
+    if (ngx_queue_empty(&keepalive->free)) {
+        // Evict the least recently used connection
+        q = ngx_queue_last(&keepalive->cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_weserv_keepalive_item_t, queue);
+
+        ngx_weserv_keepalive_close(item->connection);
+    } else {
+        q = ngx_queue_head(&keepalive->free);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_weserv_keepalive_item_t, queue);
+    }
+
+    ngx_queue_insert_head(&keepalive->cache, q);
+
+    item->connection = c;
+
+    pc->connection = nullptr;
+
+    c->read->delayed = 0;
+    ngx_add_timer(c->read, keepalive->timeout);
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    c->write->handler = ngx_weserv_keepalive_dummy_handler;
+    c->read->handler = ngx_weserv_keepalive_close_handler;
+
+    c->data = item;
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    c->pool->log = ngx_cycle->log;
+
+    item->socklen = pc->socklen;
+    ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
+
+    item->origin_len = pd->origin.len;
+    ngx_memcpy(item->origin, pd->origin.data, pd->origin.len);
+
+    if (c->read->ready) {
+        ngx_weserv_keepalive_close_handler(c->read);
+    }
+}
+
+ngx_weserv_keepalive_item_t *
+ngx_weserv_keepalive_find(ngx_weserv_keepalive_t *keepalive,
+                          const ngx_str_t &origin) {
+    for (ngx_queue_t *q = ngx_queue_head(&keepalive->cache);
+         q != ngx_queue_sentinel(&keepalive->cache); q = ngx_queue_next(q)) {
+        auto *item = ngx_queue_data(q, ngx_weserv_keepalive_item_t, queue);
+
+        if (ngx_weserv_origin_equal(item->origin, item->origin_len, origin)) {
+            return item;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Reference: ngx_http_upstream_get_keepalive_peer
+ */
+ngx_int_t ngx_weserv_upstream_get_peer(ngx_peer_connection_t *pc,
+                                       void *data) {
+    auto *pd = reinterpret_cast<ngx_weserv_upstream_peer_data_t *>(data);
+
+    // Try an idle connection to the origin first (only once, a retry
+    // connects anew)
+    ngx_weserv_keepalive_item_t *item =
+        pd->tried_cache ? nullptr
+                        : ngx_weserv_keepalive_find(pd->keepalive, pd->origin);
+
+    pd->tried_cache = 1;
+
+    if (item != nullptr) {
+        ngx_connection_t *c = item->connection;
+
+        ngx_queue_remove(&item->queue);
+        ngx_queue_insert_head(&pd->keepalive->free, &item->queue);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "weserv keepalive: using connection %p", c);
+
+        c->idle = 0;
+        c->sent = 0;
+        c->data = nullptr;
+        c->log = pc->log;
+        c->read->log = pc->log;
+        c->write->log = pc->log;
+        c->pool->log = pc->log;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+
+        ngx_memcpy(&pd->cached_sockaddr, &item->sockaddr, item->socklen);
+        pd->cached_addr.sockaddr = &pd->cached_sockaddr.sockaddr;
+        pd->cached_addr.socklen = item->socklen;
+        pd->cached_addr.name = pd->origin;
+
+        // Nothing was resolved, fall back to the address of this connection
+        if (pd->naddrs == 0) {
+            pd->addrs = &pd->cached_addr;
+            pd->naddrs = 1;
+        }
+
+        pc->sockaddr = pd->cached_addr.sockaddr;
+        pc->socklen = pd->cached_addr.socklen;
+        pc->name = &pd->cached_addr.name;
+
+        pc->connection = c;
+        pc->cached = 1;
+
+        return NGX_DONE;
+    }
+
+    if (pd->current >= pd->naddrs) {
+        return NGX_BUSY;
+    }
+
+    ngx_addr_t *addr = &pd->addrs[pd->current++];
+
+    pc->sockaddr = addr->sockaddr;
+    pc->socklen = addr->socklen;
+    pc->name = &addr->name;
+
+    return NGX_OK;
+}
+
+void ngx_weserv_upstream_free_peer(ngx_peer_connection_t *pc, void *data,
+                                   ngx_uint_t state) {
+    auto *pd = reinterpret_cast<ngx_weserv_upstream_peer_data_t *>(data);
+
+    ngx_weserv_keepalive_save(pd, pc, state);
+
+    if (pc->tries) {
+        pc->tries--;
+    }
+}
+
+#if NGX_HTTP_SSL
+ngx_weserv_ssl_session_item_t *
+ngx_weserv_ssl_session_find(ngx_weserv_keepalive_t *keepalive,
+                            const ngx_str_t &origin) {
+    for (ngx_queue_t *q = ngx_queue_head(&keepalive->sessions);
+         q != ngx_queue_sentinel(&keepalive->sessions);
+         q = ngx_queue_next(q)) {
+        auto *item = ngx_queue_data(q, ngx_weserv_ssl_session_item_t, queue);
+
+        if (ngx_weserv_origin_equal(item->origin, item->origin_len, origin)) {
+            return item;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Resume the SSL session of the origin, if there's one.
+ * Reference: ngx_http_upstream_set_round_robin_peer_session
+ */
+ngx_int_t ngx_weserv_upstream_set_session(ngx_peer_connection_t *pc,
+                                          void *data) {
+    auto *pd = reinterpret_cast<ngx_weserv_upstream_peer_data_t *>(data);
+
+    ngx_weserv_ssl_session_item_t *item =
+        ngx_weserv_ssl_session_find(pd->keepalive, pd->origin);
+    if (item == nullptr) {
+        return NGX_OK;
+    }
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&pd->keepalive->sessions, &item->queue);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "weserv set session: %p", item->session);
+
+    return ngx_ssl_set_session(pc->connection, item->session);
+}
+
+/**
+ * Reference: ngx_http_upstream_save_round_robin_peer_session
+ */
+void ngx_weserv_upstream_save_session(ngx_peer_connection_t *pc,
+                                      void *data) {
+    auto *pd = reinterpret_cast<ngx_weserv_upstream_peer_data_t *>(data);
+    ngx_weserv_keepalive_t *keepalive = pd->keepalive;
+
+    if (pd->origin.len > MAX_ORIGIN_LENGTH) {
+        return;
+    }
+
+    ngx_ssl_session_t *session = ngx_ssl_get_session(pc->connection);
+    if (session == nullptr) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "weserv save session: %p", session);
+
+    ngx_weserv_ssl_session_item_t *item =
+        ngx_weserv_ssl_session_find(keepalive, pd->origin);
+
+    if (item == nullptr) {
+        ngx_queue_t *q;
+
+        if (ngx_queue_empty(&keepalive->free_sessions)) {
+            // Evict the least recently used session
+            q = ngx_queue_last(&keepalive->sessions);
+        } else {
+            q = ngx_queue_head(&keepalive->free_sessions);
+        }
+
+        item = ngx_queue_data(q, ngx_weserv_ssl_session_item_t, queue);
+
+        item->origin_len = pd->origin.len;
+        ngx_memcpy(item->origin, pd->origin.data, pd->origin.len);
+    }
+
+    if (item->session != nullptr) {
+        ngx_ssl_free_session(item->session);
+    }
+
+    item->session = session;
+
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&keepalive->sessions, &item->queue);
+}
+#endif
+
+/**
+ * Initialize the peer of an upstream request, from the origin and the
+ * addresses resolved by `ngx_weserv_send_http_request()`.
+ */
+ngx_int_t ngx_weserv_upstream_init_peer(ngx_http_request_t *r,
+                                        ngx_http_upstream_srv_conf_t *
+                                        /* unused */) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    auto *ctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr || ctx->resolved == nullptr) {
+        return NGX_ERROR;
+    }
+
+    auto *pd = reinterpret_cast<ngx_weserv_upstream_peer_data_t *>(
+        ngx_pcalloc(r->pool, sizeof(ngx_weserv_upstream_peer_data_t)));
+    if (pd == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_upstream_resolved_t *ur = ctx->resolved;
+    ngx_http_upstream_t *u = r->upstream;
+
+    pd->keepalive = mc->keepalive_cache;
+    pd->upstream = u;
+    pd->origin = ctx->origin;
+
+    if (ur->sockaddr != nullptr) {
+        // An IP address, see `ngx_weserv_upstream_set_url()`
+        pd->addrs = reinterpret_cast<ngx_addr_t *>(
+            ngx_pcalloc(r->pool, sizeof(ngx_addr_t)));
+        if (pd->addrs == nullptr) {
+            return NGX_ERROR;
+        }
+
+        pd->addrs[0].sockaddr = ur->sockaddr;
+        pd->addrs[0].socklen = ur->socklen;
+        pd->addrs[0].name = ur->host;
+        pd->naddrs = 1;
+    } else if (ur->naddrs > 0) {
+        pd->addrs = reinterpret_cast<ngx_addr_t *>(
+            ngx_pcalloc(r->pool, ur->naddrs * sizeof(ngx_addr_t)));
+        if (pd->addrs == nullptr) {
+            return NGX_ERROR;
+        }
+
+        for (ngx_uint_t i = 0; i < ur->naddrs; ++i) {
+            pd->addrs[i].sockaddr = ur->addrs[i].sockaddr;
+            pd->addrs[i].socklen = ur->addrs[i].socklen;
+            pd->addrs[i].name = ur->addrs[i].name;
+        }
+
+        pd->naddrs = ur->naddrs;
+    }
+
+    u->peer.data = pd;
+    u->peer.get = ngx_weserv_upstream_get_peer;
+    u->peer.free = ngx_weserv_upstream_free_peer;
+
+    // Try each address once (a closed cached connection is retried for free)
+    u->peer.tries = pd->naddrs > 0 ? pd->naddrs : 1;
+
+#if NGX_HTTP_SSL
+    u->peer.set_session = ngx_weserv_upstream_set_session;
+    u->peer.save_session = ngx_weserv_upstream_save_session;
+
+    // The server name (SNI) of the origin, rather than of this upstream
+    u->ssl_name = ur->host;
+#endif
+
+    return NGX_OK;
+}
+
+}  // namespace
+
+ngx_weserv_keepalive_t *ngx_weserv_keepalive_create(ngx_pool_t *pool,
+                                                    ngx_uint_t connections,
+                                                    ngx_msec_t timeout) {
+    auto *keepalive = reinterpret_cast<ngx_weserv_keepalive_t *>(
+        ngx_pcalloc(pool, sizeof(ngx_weserv_keepalive_t)));
+    if (keepalive == nullptr) {
+        return nullptr;
+    }
+
+    keepalive->timeout = timeout;
+
+    ngx_queue_init(&keepalive->cache);
+    ngx_queue_init(&keepalive->free);
+
+    if (connections > 0) {
+        auto *items = reinterpret_cast<ngx_weserv_keepalive_item_t *>(
+            ngx_pcalloc(pool,
+                        connections * sizeof(ngx_weserv_keepalive_item_t)));
+        if (items == nullptr) {
+            return nullptr;
+        }
+
+        for (ngx_uint_t i = 0; i < connections; ++i) {
+            items[i].keepalive = keepalive;
+            ngx_queue_insert_head(&keepalive->free, &items[i].queue);
+        }
+    }
+
+#if NGX_HTTP_SSL
+    ngx_queue_init(&keepalive->sessions);
+    ngx_queue_init(&keepalive->free_sessions);
+
+    auto *sessions = reinterpret_cast<ngx_weserv_ssl_session_item_t *>(
+        ngx_pcalloc(pool,
+                    SSL_SESSIONS * sizeof(ngx_weserv_ssl_session_item_t)));
+    if (sessions == nullptr) {
+        return nullptr;
+    }
+
+    for (ngx_uint_t i = 0; i < SSL_SESSIONS; ++i) {
+        ngx_queue_insert_head(&keepalive->free_sessions, &sessions[i].queue);
+    }
+#endif
+
+    return keepalive;
+}
+
+bool ngx_weserv_keepalive_has_connection(ngx_weserv_keepalive_t *keepalive,
+                                         const ngx_str_t &origin) {
+    return ngx_weserv_keepalive_find(keepalive, origin) != nullptr;
+}
+
+ngx_http_upstream_srv_conf_t *ngx_weserv_keepalive_upstream(ngx_pool_t *pool) {
+    auto *us = reinterpret_cast<ngx_http_upstream_srv_conf_t *>(
+        ngx_pcalloc(pool, sizeof(ngx_http_upstream_srv_conf_t)));
+    if (us == nullptr) {
+        return nullptr;
+    }
+
+    ngx_str_set(&us->host, "weserv");
+    us->peer.init = ngx_weserv_upstream_init_peer;
+
+    return us;
+}
+
+}  // namespace nginx
+}  // namespace weserv
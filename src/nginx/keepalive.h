@@ -0,0 +1,43 @@
+#pragma once
+
+extern "C" {
+#include <ngx_http.h>
+}
+
+namespace weserv {
+namespace nginx {
+
+/**
+ * The idle keepalive connections to origin servers, along with their SSL
+ * sessions, cached by each worker process. Both are keyed by the origin
+ * (i.e. the scheme, host and port).
+ */
+struct ngx_weserv_keepalive_t;
+
+/**
+ * Create the keepalive cache.
+ * @param pool Pool to allocate the cache from.
+ * @param connections The maximum number of idle connections to keep (0
+ *                    disables caching connections).
+ * @param timeout How long an idle connection is kept.
+ * @return The cache, or nullptr if out of memory.
+ */
+ngx_weserv_keepalive_t *ngx_weserv_keepalive_create(ngx_pool_t *pool,
+                                                    ngx_uint_t connections,
+                                                    ngx_msec_t timeout);
+
+/**
+ * Is there an idle connection to the given origin? If so, it doesn't need
+ * to be resolved (again).
+ */
+bool ngx_weserv_keepalive_has_connection(ngx_weserv_keepalive_t *keepalive,
+                                         const ngx_str_t &origin);
+
+/**
+ * Create the upstream configuration that connects to origin servers through
+ * the keepalive cache, see `ngx_weserv_upstream_init_peer()`.
+ */
+ngx_http_upstream_srv_conf_t *ngx_weserv_keepalive_upstream(ngx_pool_t *pool);
+
+}  // namespace nginx
+}  // namespace weserv
@@ -12,6 +12,71 @@ using ::weserv::api::utils::Status;
 namespace weserv {
 namespace nginx {
 
+ngx_http_output_header_filter_pt ngx_http_next_header_filter;
+ngx_http_output_body_filter_pt ngx_http_next_body_filter;
+
+std::string ngx_weserv_build_query(ngx_http_request_t *r,
+                                   ngx_weserv_loc_conf_t *lc) {
+    std::string query = ngx_str_to_std(r->args);
+
+    // Let the API negotiate the output format. This is prepended to the
+    // query, so that it can't be overridden by the client.
+    if (is_auto_output_needed(r)) {
+        query = "accept=" + get_accepted_formats(r) + "&" + query;
+    }
+
+    // The number of threads a large PNG is deflated on, prepended as well,
+    // since the client shouldn't be able to spawn threads
+    query = "png_threads=" + std::to_string(lc->png_threads) + "&" + query;
+
+    // The default WebP effort of this location, appended to the query so
+    // that the client can still override it with `&effort=`
+    if (lc->webp_effort != NGX_CONF_UNSET) {
+        query += "&webp_effort=" + std::to_string(lc->webp_effort);
+    }
+
+    return query;
+}
+
+ngx_int_t ngx_weserv_finish(ngx_http_request_t *r, ngx_chain_t *out) {
+    ngx_int_t rc = ngx_http_next_header_filter(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    // A HEAD request (or a 304 Not Modified response), without a body
+    if (r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+void ngx_weserv_image_filter_free_buf(ngx_http_request_t *r,
+                                      ngx_weserv_base_ctx_t *ctx) {
+    auto tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
+    ngx_chain_t *cl = ctx->in;
+
+    while (cl) {
+        ngx_chain_t *next = cl->next;
+
+        // Only the copies made by ngx_weserv_image_filter_buffer are ours,
+        // the other buffers (the empty, flush or last buffer and those that
+        // follow it) belong to the upstream
+        if (cl->buf->tag == tag) {
+            ngx_pfree(r->pool, cl->buf->start);
+        }
+
+        // The chain links are ours, either way
+        ngx_free_chain(r->pool, cl);
+
+        cl = next;
+    }
+
+    ctx->in = nullptr;
+}
+
 namespace {
 /**
  * Configuration - function declarations.
@@ -21,6 +86,18 @@ namespace {
  * Creates the module's main context configuration structure.
  */
 void *ngx_weserv_create_main_conf(ngx_conf_t *cf);
+char *ngx_weserv_init_main_conf(ngx_conf_t *cf, void *conf);
+
+/**
+ * Parses the `weserv_keepalive` directive.
+ */
+char *ngx_weserv_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+
+/**
+ * Parses the `weserv_resolver_cache` directive.
+ */
+char *ngx_weserv_resolver_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+                                void *conf);
 
 /**
  * Creates the module's location context configuration structure.
@@ -28,20 +105,32 @@ void *ngx_weserv_create_main_conf(ngx_conf_t *cf);
 void *ngx_weserv_create_loc_conf(ngx_conf_t *cf);
 char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child);
 
+/**
+ * Pre-configuration initialization, registers the module's variables.
+ */
+ngx_int_t ngx_weserv_preconfiguration(ngx_conf_t *cf);
+
 /**
  * Post-configuration initialization.
  */
 ngx_int_t ngx_weserv_postconfiguration(ngx_conf_t *cf);
 
-ngx_http_output_header_filter_pt ngx_http_next_header_filter;
-ngx_http_output_body_filter_pt ngx_http_next_body_filter;
-
 ngx_conf_enum_t ngx_weserv_mode[] = {
     {ngx_string("proxy"), NGX_WESERV_PROXY_MODE},
     {ngx_string("file"), NGX_WESERV_FILE_MODE},
     {ngx_null_string, 0}  // last entry
 };
 
+ngx_conf_num_bounds_t ngx_weserv_webp_effort_bounds = {
+    ngx_conf_check_num_bounds, 0, 6};
+
+ngx_conf_num_bounds_t ngx_weserv_png_threads_bounds = {
+    ngx_conf_check_num_bounds, 1, 64};
+
+// Share the temp path (and its levels) with the proxy module by default
+ngx_path_init_t ngx_weserv_temp_path = {ngx_string(NGX_HTTP_PROXY_TEMP_PATH),
+                                        {1, 2, 0}};
+
 /**
  * The module commands contain list of configurable properties for this module.
  */
@@ -87,11 +176,43 @@ ngx_command_t ngx_weserv_commands[] = {
         offsetof(ngx_weserv_loc_conf_t, max_size),
         nullptr,
     },
+    {ngx_string("weserv_buffer_size"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_conf_set_size_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, buffer_size), nullptr},
+    {ngx_string("weserv_temp_path"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1234,
+     ngx_conf_set_path_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, upstream_conf.temp_path), nullptr},
     {ngx_string("weserv_max_redirects"),
      NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
          NGX_CONF_TAKE1,
      ngx_conf_set_num_slot, NGX_HTTP_LOC_CONF_OFFSET,
      offsetof(ngx_weserv_loc_conf_t, max_redirects), nullptr},
+    {ngx_string("weserv_webp_effort"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, webp_effort),
+     &ngx_weserv_webp_effort_bounds},
+    {ngx_string("weserv_png_threads"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_TAKE1,
+     ngx_conf_set_num_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, png_threads),
+     &ngx_weserv_png_threads_bounds},
+    {ngx_string("weserv_streaming"),
+     NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF |
+         NGX_CONF_FLAG,
+     ngx_conf_set_flag_slot, NGX_HTTP_LOC_CONF_OFFSET,
+     offsetof(ngx_weserv_loc_conf_t, streaming), nullptr},
+    {ngx_string("weserv_keepalive"), NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE12,
+     ngx_weserv_keepalive, NGX_HTTP_MAIN_CONF_OFFSET, 0, nullptr},
+    {ngx_string("weserv_resolver_cache"),
+     NGX_HTTP_MAIN_CONF | NGX_CONF_TAKE123, ngx_weserv_resolver_cache,
+     NGX_HTTP_MAIN_CONF_OFFSET, 0, nullptr},
     ngx_null_command  // last entry
 };
 
@@ -100,13 +221,13 @@ ngx_command_t ngx_weserv_commands[] = {
  */
 ngx_http_module_t ngx_weserv_module_ctx = {
     // ngx_int_t (*preconfiguration)(ngx_conf_t *cf);
-    nullptr,
+    ngx_weserv_preconfiguration,
     // ngx_int_t (*postconfiguration)(ngx_conf_t *cf);
     ngx_weserv_postconfiguration,
     // void *(*create_main_conf)(ngx_conf_t *cf);
     ngx_weserv_create_main_conf,
     // char *(*init_main_conf)(ngx_conf_t *cf, void *conf);
-    nullptr,
+    ngx_weserv_init_main_conf,
     // void *(*create_srv_conf)(ngx_conf_t *cf);
     nullptr,
     // char *(*merge_srv_conf)(ngx_conf_t *cf, void *prev, void *conf);
@@ -127,9 +248,139 @@ void *ngx_weserv_create_main_conf(ngx_conf_t *cf) {
         return nullptr;
     }
 
+    conf->keepalive = NGX_CONF_UNSET_UINT;
+    conf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
+
     return conf;
 }
 
+/**
+ * Initialize weserv module's main context configuration
+ */
+char *ngx_weserv_init_main_conf(ngx_conf_t *cf, void *conf) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(conf);
+
+    // We keep 32 idle connections to origin servers for 60 seconds by default
+    ngx_conf_init_uint_value(mc->keepalive, 32);
+    ngx_conf_init_msec_value(mc->keepalive_timeout, 60000);
+
+    mc->keepalive_cache = ngx_weserv_keepalive_create(
+        cf->pool, mc->keepalive, mc->keepalive_timeout);
+    if (mc->keepalive_cache == nullptr) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    return reinterpret_cast<char *>(NGX_CONF_OK);
+}
+
+/**
+ * Parses `weserv_keepalive connections [timeout];`, a connections value of
+ * 0 disables keepalive connections to origin servers.
+ * Reference: ngx_http_upstream_keepalive
+ */
+char *ngx_weserv_keepalive(ngx_conf_t *cf, ngx_command_t * /* unused */,
+                           void *conf) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(conf);
+
+    if (mc->keepalive != NGX_CONF_UNSET_UINT) {
+        return const_cast<char *>("is duplicate");
+    }
+
+    auto *value = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+
+    ngx_int_t n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &value[0]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    mc->keepalive = n;
+
+    if (cf->args->nelts == 3) {
+        ngx_msec_t timeout = ngx_parse_time(&value[2], 0);
+        if (timeout == static_cast<ngx_msec_t>(NGX_ERROR)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid value \"%V\" in \"%V\" directive",
+                               &value[2], &value[0]);
+            return reinterpret_cast<char *>(NGX_CONF_ERROR);
+        }
+
+        mc->keepalive_timeout = timeout;
+    }
+
+    return reinterpret_cast<char *>(NGX_CONF_OK);
+}
+
+/**
+ * Parses `weserv_resolver_cache size [stale=time] [negative=time];`.
+ * Reference: ngx_http_upstream_zone
+ */
+char *ngx_weserv_resolver_cache(ngx_conf_t *cf, ngx_command_t * /* unused */,
+                                void *conf) {
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(conf);
+
+    if (mc->resolver_cache != nullptr) {
+        return const_cast<char *>("is duplicate");
+    }
+
+    auto *value = reinterpret_cast<ngx_str_t *>(cf->args->elts);
+
+    ssize_t size = ngx_parse_size(&value[1]);
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive",
+                           &value[1], &value[0]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    if (size < static_cast<ssize_t>(8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "resolver cache \"%V\" is too small", &value[1]);
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    // Expired addresses are used for another 60 seconds while they're
+    // refreshed, and nonexistent host names are cached for 10 seconds
+    time_t stale = 60;
+    time_t negative = 10;
+
+    for (ngx_uint_t i = 2; i < cf->args->nelts; ++i) {
+        time_t *param = nullptr;
+        ngx_str_t s;
+
+        if (ngx_strncmp(value[i].data, "stale=", 6) == 0) {
+            param = &stale;
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+        } else if (ngx_strncmp(value[i].data, "negative=", 9) == 0) {
+            param = &negative;
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+        }
+
+        if (param != nullptr) {
+            *param = ngx_parse_time(&s, 1);
+        }
+
+        if (param == nullptr || *param == static_cast<time_t>(NGX_ERROR)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid value \"%V\" in \"%V\" directive",
+                               &value[i], &value[0]);
+            return reinterpret_cast<char *>(NGX_CONF_ERROR);
+        }
+    }
+
+    mc->resolver_cache =
+        ngx_weserv_resolver_cache_create(cf, size, stale, negative);
+    if (mc->resolver_cache == nullptr) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
+    return reinterpret_cast<char *>(NGX_CONF_OK);
+}
+
 /**
  * Create weserv module's location config.
  */
@@ -157,6 +408,16 @@ void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
     lc->upstream_conf.pass_request_headers = 0;
     lc->upstream_conf.pass_request_body = 0;
 
+    // Connect to origin servers through the keepalive cache, see
+    // ngx_weserv_upstream_init_peer(). A closed keepalive connection is
+    // retried on a new connection, and so is the next resolved address.
+    lc->upstream_conf.upstream = ngx_weserv_keepalive_upstream(cf->pool);
+    if (lc->upstream_conf.upstream == nullptr) {
+        return nullptr;
+    }
+
+    lc->upstream_conf.next_upstream = NGX_HTTP_UPSTREAM_FT_ERROR;
+
     lc->upstream_conf.hide_headers =
         reinterpret_cast<ngx_array_t *>(NGX_CONF_UNSET_PTR);
     lc->upstream_conf.pass_headers =
@@ -189,6 +450,14 @@ void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
 
     ssl_cleanup->handler = ngx_ssl_cleanup_ctx;
 
+#if nginx_version >= 1013000
+    // Save the SSL sessions of origin servers once they arrive (TLSv1.3
+    // sends them after the handshake), see ngx_weserv_upstream_save_session()
+    if (ngx_ssl_client_session_cache(cf, ssl, 1) != NGX_OK) {
+        return nullptr;
+    }
+#endif
+
     lc->upstream_conf.ssl = ssl;
     lc->upstream_conf.ssl_session_reuse = 1;
 
@@ -199,7 +468,11 @@ void *ngx_weserv_create_loc_conf(ngx_conf_t *cf) {
     lc->enable = NGX_CONF_UNSET;
     lc->mode = NGX_CONF_UNSET_UINT;
     lc->max_size = NGX_CONF_UNSET_SIZE;
+    lc->buffer_size = NGX_CONF_UNSET_SIZE;
     lc->max_redirects = NGX_CONF_UNSET_UINT;
+    lc->webp_effort = NGX_CONF_UNSET;
+    lc->png_threads = NGX_CONF_UNSET;
+    lc->streaming = NGX_CONF_UNSET;
 
     return lc;
 }
@@ -229,9 +502,47 @@ char *ngx_weserv_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child) {
     ngx_conf_merge_size_value(conf->max_size, prev->max_size,
                               100 * 1024 * 1024);
 
+    // Images larger than 8 MiB are buffered to a temporary file by default
+    ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
+                              8 * 1024 * 1024);
+
+    if (ngx_conf_merge_path_value(cf, &conf->upstream_conf.temp_path,
+                                  prev->upstream_conf.temp_path,
+                                  &ngx_weserv_temp_path) != NGX_OK) {
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+
     // We follow 10 redirects by default
     ngx_conf_merge_uint_value(conf->max_redirects, prev->max_redirects, 10);
 
+    // Leave the WebP effort to the API by default
+    ngx_conf_merge_value(conf->webp_effort, prev->webp_effort,
+                         NGX_CONF_UNSET);
+
+    // Large PNG images are deflated on a single thread by default
+    ngx_conf_merge_value(conf->png_threads, prev->png_threads, 1);
+
+    // The output is sent once it's complete by default
+    ngx_conf_merge_value(conf->streaming, prev->streaming, 0);
+
+#if (NGX_THREADS)
+    // Streamed images are processed on the default thread pool, so that the
+    // event loop can send the output meanwhile
+    if (conf->streaming && conf->thread_pool == nullptr) {
+        conf->thread_pool = ngx_thread_pool_add(cf, nullptr);
+        if (conf->thread_pool == nullptr) {
+            return reinterpret_cast<char *>(NGX_CONF_ERROR);
+        }
+    }
+#else
+    if (conf->streaming) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"weserv_streaming\" requires nginx to be built "
+                           "with thread pools (--with-threads)");
+        return reinterpret_cast<char *>(NGX_CONF_ERROR);
+    }
+#endif
+
     return reinterpret_cast<char *>(NGX_CONF_OK);
 }
 
@@ -288,22 +599,12 @@ ngx_int_t ngx_weserv_image_header_filter(ngx_http_request_t *r) {
     return NGX_OK;
 }
 
-ngx_int_t ngx_weserv_finish(ngx_http_request_t *r, ngx_chain_t *out) {
-    ngx_int_t rc = ngx_http_next_header_filter(r);
-
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return NGX_ERROR;
-    }
-
-    return ngx_http_next_body_filter(r, out);
-}
-
 #if NGX_DEBUG
 ngx_int_t ngx_weserv_finish_debug(ngx_http_request_t *r, ngx_chain_t *out) {
     off_t content_length = 0;
 
     for (ngx_chain_t *cl = out; cl; cl = cl->next) {
-        content_length += cl->buf->last - cl->buf->pos;
+        content_length += ngx_buf_size(cl->buf);
     }
 
     r->headers_out.status = NGX_HTTP_OK;
@@ -320,8 +621,72 @@ ngx_int_t ngx_weserv_finish_debug(ngx_http_request_t *r, ngx_chain_t *out) {
 
     return ngx_weserv_finish(r, out);
 }
+
+/**
+ * Output the buffered upstream response as is, read back from the temporary
+ * file if it was spilled.
+ */
+ngx_int_t ngx_weserv_finish_debug_buffered(ngx_http_request_t *r,
+                                           ngx_weserv_base_ctx_t *ctx) {
+    if (ctx->temp_file == nullptr) {
+        return ngx_weserv_finish_debug(r, ctx->in);
+    }
+
+    ngx_buf_t *b = ngx_calloc_buf(r->pool);
+    if (b == nullptr) {
+        return NGX_ERROR;
+    }
+
+    b->in_file = 1;
+    b->file = &ctx->temp_file->file;
+    b->file_pos = 0;
+    b->file_last = ctx->temp_file->offset;
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+    ngx_chain_t out;
+    out.buf = b;
+    out.next = nullptr;
+
+    return ngx_weserv_finish_debug(r, &out);
+}
 #endif
 
+ngx_int_t ngx_weserv_image_filter_spill(ngx_http_request_t *r,
+                                        ngx_weserv_base_ctx_t *ctx) {
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
+    auto *tf = reinterpret_cast<ngx_temp_file_t *>(
+        ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t)));
+    if (tf == nullptr) {
+        return NGX_ERROR;
+    }
+
+    tf->file.fd = NGX_INVALID_FILE;
+    tf->file.log = r->connection->log;
+    tf->path = lc->upstream_conf.temp_path;
+    tf->pool = r->pool;
+    tf->warn = "an upstream image is buffered to a temporary file";
+    tf->log_level = NGX_LOG_INFO;
+
+    // Remove the file once the request is finalized
+    tf->clean = 1;
+
+    ctx->temp_file = tf;
+
+    // Move what's buffered in memory so far to the file
+    if (ctx->in != nullptr) {
+        if (ngx_write_chain_to_temp_file(tf, ctx->in) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        ngx_weserv_image_filter_free_buf(r, ctx);
+    }
+
+    return NGX_OK;
+}
+
 ngx_int_t ngx_weserv_image_filter_buffer(ngx_http_request_t *r,
                                          ngx_weserv_base_ctx_t *ctx,
                                          ngx_chain_t *in) {
@@ -329,20 +694,22 @@ ngx_int_t ngx_weserv_image_filter_buffer(ngx_http_request_t *r,
 
     r->connection->buffered |= NGX_WESERV_IMAGE_BUFFERED;
 
+    auto *lc = reinterpret_cast<ngx_weserv_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_weserv_module));
+
     ll = &ctx->in;
 
     for (cl = ctx->in; cl; cl = cl->next) {
         ll = &cl->next;
     }
 
+    // The buffers to write to the temporary file, if spilled
+    ngx_chain_t *spill = nullptr;
+    ngx_chain_t **spill_ll = &spill;
+
     bool buffering = true;
 
     while (in) {
-        cl = ngx_alloc_chain_link(r->pool);
-        if (cl == nullptr) {
-            return NGX_ERROR;
-        }
-
         ngx_buf_t *b = in->buf;
 
         size_t size = b->last - b->pos;
@@ -351,7 +718,32 @@ ngx_int_t ngx_weserv_image_filter_buffer(ngx_http_request_t *r,
             buffering = false;
         }
 
-        if (buffering && size) {
+        // Spill large images to a temporary file, so that they don't need to
+        // be held in memory (the mapped file pages can be reclaimed)
+        if (buffering && size && ctx->temp_file == nullptr &&
+            lc->buffer_size != 0 &&
+            ctx->length + static_cast<off_t>(size) >
+                static_cast<off_t>(lc->buffer_size)) {
+            if (ngx_weserv_image_filter_spill(r, ctx) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ll = &ctx->in;
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == nullptr) {
+            return NGX_ERROR;
+        }
+
+        ctx->length += size;
+
+        if (ctx->temp_file != nullptr) {
+            cl->buf = b;
+
+            *spill_ll = cl;
+            spill_ll = &cl->next;
+        } else if (buffering && size) {
             ngx_buf_t *buf = ngx_create_temp_buf(r->pool, size);
             if (buf == nullptr) {
                 return NGX_ERROR;
@@ -367,32 +759,38 @@ ngx_int_t ngx_weserv_image_filter_buffer(ngx_http_request_t *r,
 
             cl->buf = buf;
 
+            *ll = cl;
+            ll = &cl->next;
         } else {
             cl->buf = b;
+
+            *ll = cl;
+            ll = &cl->next;
         }
 
-        *ll = cl;
-        ll = &cl->next;
         in = in->next;
     }
 
     *ll = nullptr;
+    *spill_ll = nullptr;
 
-    return buffering ? NGX_OK : NGX_DONE;
-}
+    if (spill != nullptr) {
+        if (ngx_write_chain_to_temp_file(ctx->temp_file, spill) ==
+            NGX_ERROR) {
+            return NGX_ERROR;
+        }
 
-void ngx_weserv_image_filter_free_buf(ngx_http_request_t *r,
-                                      ngx_weserv_base_ctx_t *ctx) {
-    for (ngx_chain_t *cl = ctx->in; cl; cl = cl->next) {
-        if (cl->buf->tag == (ngx_buf_tag_t)&ngx_weserv_module) {
-            ngx_pfree(r->pool, cl->buf->start);
-        } else {
+        // Mark the buffers as consumed
+        while (spill) {
+            cl = spill;
+            spill = spill->next;
+
+            cl->buf->pos = cl->buf->last;
             ngx_free_chain(r->pool, cl);
-            break;
         }
     }
 
-    ctx->in = nullptr;
+    return buffering ? NGX_OK : NGX_DONE;
 }
 
 ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
@@ -464,18 +862,49 @@ ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
     if (debug_output) {
         r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
 
-        return ngx_weserv_finish_debug(r, ctx->in);
+        return ngx_weserv_finish_debug_buffered(r, ctx);
     }
 #endif
 
     auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
         ngx_http_get_module_main_conf(r, ngx_weserv_module));
 
+    std::string query = ngx_weserv_build_query(r, lc);
+
+    // Let libvips read (and map) the temporary file directly, if spilled
+    ngx_fd_t fd = ctx->temp_file != nullptr ? ctx->temp_file->file.fd
+                                            : NGX_INVALID_FILE;
+    ngx_chain_t *in_chain = ctx->in;
+
+#if (NGX_THREADS)
+    if (NgxStream::is_possible(r, lc)) {
+        // The connection stays buffered until the image is processed
+        return NgxStream::post(
+            r, lc,
+            [mc, query, fd, r, in_chain](
+                std::unique_ptr<api::io::TargetInterface> target) {
+                return fd != NGX_INVALID_FILE
+                           ? mc->weserv->process_descriptor(query, fd,
+                                                            std::move(target))
+                           : mc->weserv->process(
+                                 query,
+                                 std::unique_ptr<api::io::SourceInterface>(
+                                     new NgxSource(r, in_chain)),
+                                 std::move(target));
+            });
+    }
+#endif
+
     ngx_chain_t *out = nullptr;
-    Status status = mc->weserv->process(
-        ngx_str_to_std(r->args),
-        std::unique_ptr<api::io::SourceInterface>(new NgxSource(r, ctx->in)),
-        std::unique_ptr<api::io::TargetInterface>(new NgxTarget(r, &out)));
+    std::unique_ptr<api::io::TargetInterface> target(new NgxTarget(r, &out));
+
+    Status status =
+        fd != NGX_INVALID_FILE
+            ? mc->weserv->process_descriptor(query, fd, std::move(target))
+            : mc->weserv->process(query,
+                                  std::unique_ptr<api::io::SourceInterface>(
+                                      new NgxSource(r, in_chain)),
+                                  std::move(target));
 
     r->connection->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
 
@@ -484,10 +913,6 @@ ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
     ngx_weserv_image_filter_free_buf(r, ctx);
 
     if (status.ok()) {
-        if (is_base64_needed(r) && output_chain_to_base64(r, out) != NGX_OK) {
-            return NGX_ERROR;
-        }
-
         return ngx_weserv_finish(r, out);
     } else {
         ngx_chain_t error;
@@ -499,6 +924,125 @@ ngx_int_t ngx_weserv_image_body_filter(ngx_http_request_t *r, ngx_chain_t *in) {
     }
 }
 
+/**
+ * The `$weserv_accept` variable, the image formats negotiated with the Accept
+ * request header for `&output=auto` (empty otherwise). This should be part of
+ * the cache key, since the response varies on it.
+ */
+ngx_int_t ngx_weserv_accept_variable(ngx_http_request_t *r,
+                                     ngx_http_variable_value_t *v,
+                                     uintptr_t /* unused */) {
+    std::string formats =
+        is_auto_output_needed(r) ? get_accepted_formats(r) : "";
+
+    v->data = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, formats.size()));
+    if (v->data == nullptr) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_cpymem(v->data, formats.data(), formats.size()) - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+/**
+ * The upstream runtime state of the request, if the image was fetched from
+ * an origin server.
+ */
+ngx_weserv_upstream_ctx_t *ngx_weserv_get_upstream_ctx(ngx_http_request_t *r) {
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    if (ctx == nullptr || ctx->id() != NGX_WESERV_UPSTREAM_CTX) {
+        return nullptr;
+    }
+
+    return reinterpret_cast<ngx_weserv_upstream_ctx_t *>(ctx);
+}
+
+/**
+ * The `$weserv_resolve_time` variable, the time spent resolving the origin
+ * (in seconds with a milliseconds resolution), apart from connecting to it.
+ */
+ngx_int_t ngx_weserv_resolve_time_variable(ngx_http_request_t *r,
+                                           ngx_http_variable_value_t *v,
+                                           uintptr_t /* unused */) {
+    ngx_weserv_upstream_ctx_t *ctx = ngx_weserv_get_upstream_ctx(r);
+
+    if (ctx == nullptr || ctx->resolve_status.len == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = reinterpret_cast<u_char *>(
+        ngx_pnalloc(r->pool, NGX_TIME_T_LEN + 4));
+    if (v->data == nullptr) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(v->data, "%T.%03M",
+                         static_cast<time_t>(ctx->resolve_time / 1000),
+                         ctx->resolve_time % 1000) -
+             v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+/**
+ * The `$weserv_resolve_cache` variable, whether the addresses of the origin
+ * came from the resolver cache (HIT, STALE, MISS or NEGATIVE). KEEPALIVE if
+ * an idle keepalive connection to the origin was reused instead, without
+ * resolving it.
+ */
+ngx_int_t ngx_weserv_resolve_cache_variable(ngx_http_request_t *r,
+                                            ngx_http_variable_value_t *v,
+                                            uintptr_t /* unused */) {
+    ngx_weserv_upstream_ctx_t *ctx = ngx_weserv_get_upstream_ctx(r);
+
+    if (ctx == nullptr || ctx->resolve_status.len == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = ctx->resolve_status.data;
+    v->len = ctx->resolve_status.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+ngx_http_variable_t ngx_weserv_variables[] = {
+    {ngx_string("weserv_accept"), nullptr, ngx_weserv_accept_variable, 0,
+     NGX_HTTP_VAR_NOCACHEABLE, 0},
+    {ngx_string("weserv_resolve_time"), nullptr,
+     ngx_weserv_resolve_time_variable, 0, NGX_HTTP_VAR_NOCACHEABLE, 0},
+    {ngx_string("weserv_resolve_cache"), nullptr,
+     ngx_weserv_resolve_cache_variable, 0, NGX_HTTP_VAR_NOCACHEABLE, 0},
+};
+
+ngx_int_t ngx_weserv_preconfiguration(ngx_conf_t *cf) {
+    for (auto &v : ngx_weserv_variables) {
+        ngx_http_variable_t *var =
+            ngx_http_add_variable(cf, &v.name, v.flags);
+        if (var == nullptr) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v.get_handler;
+        var->data = v.data;
+    }
+
+    return NGX_OK;
+}
+
 ngx_int_t ngx_weserv_postconfiguration(ngx_conf_t *cf) {
     ngx_http_next_header_filter = ngx_http_top_header_filter;
     ngx_http_top_header_filter = ngx_weserv_image_header_filter;
@@ -7,6 +7,8 @@ extern "C" {
 #include <weserv/api_manager.h>
 
 #include "http_request.h"
+#include "keepalive.h"
+#include "resolver.h"
 
 #include <map>
 #include <memory>
@@ -31,6 +33,24 @@ struct ngx_weserv_main_conf_t {
      * The module-level API Manager interface.
      */
     std::shared_ptr<api::ApiManager> weserv;
+
+    /**
+     * The maximum number of idle keepalive connections to origin servers
+     * that each worker process keeps, and for how long.
+     */
+    ngx_uint_t keepalive;
+    ngx_msec_t keepalive_timeout;
+
+    /**
+     * The idle keepalive connections and SSL sessions of origin servers.
+     */
+    ngx_weserv_keepalive_t *keepalive_cache;
+
+    /**
+     * The resolved addresses of origin servers, shared across worker
+     * processes (nullptr if disabled).
+     */
+    ngx_weserv_resolver_cache_t *resolver_cache;
 };
 
 /**
@@ -50,7 +70,22 @@ struct ngx_weserv_loc_conf_t {
 
     size_t max_size;
 
+    size_t buffer_size;
+
     ngx_uint_t max_redirects;
+
+    ngx_int_t webp_effort;
+
+    ngx_int_t png_threads;
+
+    ngx_flag_t streaming;
+
+#if (NGX_THREADS)
+    /**
+     * The thread pool images are processed on when streamed.
+     */
+    ngx_thread_pool_t *thread_pool;
+#endif
 };
 
 /**
@@ -67,6 +102,17 @@ struct ngx_weserv_base_ctx_t {
      */
     ngx_chain_t *in;
 
+    /**
+     * The temporary file the incoming chain is written to, once it exceeds
+     * `weserv_buffer_size`.
+     */
+    ngx_temp_file_t *temp_file;
+
+    /**
+     * The number of bytes received so far.
+     */
+    off_t length;
+
     virtual int id() const {
         return NGX_WESERV_BASE_CTX;
     }
@@ -91,6 +137,23 @@ struct ngx_weserv_upstream_ctx_t : ngx_weserv_base_ctx_t {
     ngx_str_t url_path;
     ngx_str_t host_header;
 
+    /**
+     * The origin server; its scheme, host and port, and its addresses once
+     * resolved. Used to look up idle keepalive connections and SSL sessions.
+     */
+    ngx_str_t origin;
+    ngx_http_upstream_resolved_t *resolved;
+
+    /**
+     * How long it took to resolve the origin, and whether its addresses
+     * came from the resolver cache (HIT, STALE, MISS or NEGATIVE). KEEPALIVE
+     * if it wasn't resolved since there's an idle keepalive connection to
+     * it, and empty if it's an IP address.
+     */
+    ngx_msec_t resolve_start;
+    ngx_msec_t resolve_time;
+    ngx_str_t resolve_status;
+
     /**
      * A unique pointer to the HTTP request object created by the caller
      * (contains headers, body, HTTP verb, URL, timeout, and max number of
@@ -138,6 +201,31 @@ struct ngx_weserv_upstream_ctx_t : ngx_weserv_base_ctx_t {
     }
 };
 
+/**
+ * The next header and body filters in the chain, see
+ * `ngx_weserv_postconfiguration()`.
+ */
+extern ngx_http_output_header_filter_pt ngx_http_next_header_filter;
+extern ngx_http_output_body_filter_pt ngx_http_next_body_filter;
+
+/**
+ * Get the query string to pass on to the API, along with the settings of
+ * this location.
+ */
+std::string ngx_weserv_build_query(ngx_http_request_t *r,
+                                   ngx_weserv_loc_conf_t *lc);
+
+/**
+ * Send the response headers and the given output to the next filters.
+ */
+ngx_int_t ngx_weserv_finish(ngx_http_request_t *r, ngx_chain_t *out);
+
+/**
+ * Release the buffered (upstream) image, once processed.
+ */
+void ngx_weserv_image_filter_free_buf(ngx_http_request_t *r,
+                                      ngx_weserv_base_ctx_t *ctx);
+
 }  // namespace nginx
 }  // namespace weserv
 
@@ -0,0 +1,643 @@
+#include "resolver.h"
+
+#include "module.h"
+
+#include <algorithm>
+
+using ::weserv::api::utils::Status;
+
+namespace weserv {
+namespace nginx {
+
+// The maximum number of addresses cached per host name
+const ngx_uint_t MAX_ADDRS = 8;
+
+namespace {
+
+/**
+ * The shared memory part of the resolver cache; the cached host names in a
+ * tree (keyed by the lowercase host name) and in a queue (least recently
+ * used last, evicted once the zone is full).
+ */
+struct ngx_weserv_resolver_shctx_t {
+    ngx_rbtree_t rbtree;
+    ngx_rbtree_node_t sentinel;
+    ngx_queue_t queue;
+};
+
+struct ngx_weserv_resolver_addr_t {
+    socklen_t socklen;
+    ngx_sockaddr_t sockaddr;
+};
+
+/**
+ * A cached host name.
+ */
+struct ngx_weserv_resolver_node_t {
+    ngx_str_node_t sn;
+
+    ngx_queue_t queue;
+
+    /**
+     * Until when the addresses are fresh.
+     */
+    time_t expires;
+
+    /**
+     * Until when a refresh is in flight (in any of the worker processes).
+     */
+    time_t updating;
+
+    /**
+     * The resolver error of a nonexistent host name (a negative entry,
+     * without addresses).
+     */
+    ngx_int_t state;
+
+    ngx_uint_t naddrs;
+    ngx_weserv_resolver_addr_t addrs[MAX_ADDRS];
+
+    u_char data[1];
+};
+
+/**
+ * A refresh of a cached host name, in the background.
+ */
+struct ngx_weserv_resolver_refresh_t {
+    ngx_weserv_resolver_cache_t *cache;
+
+    ngx_str_t name;
+};
+
+enum class CacheResult {
+    Miss,
+    Hit,
+    Stale,
+    Negative,
+};
+
+}  // namespace
+
+struct ngx_weserv_resolver_cache_t {
+    ngx_weserv_resolver_shctx_t *sh;
+    ngx_slab_pool_t *shpool;
+
+    time_t stale;
+    time_t negative;
+};
+
+namespace {
+
+/**
+ * Reference: ngx_http_limit_req_init_zone
+ */
+ngx_int_t ngx_weserv_resolver_cache_init_zone(ngx_shm_zone_t *shm_zone,
+                                              void *data) {
+    auto *ocache = reinterpret_cast<ngx_weserv_resolver_cache_t *>(data);
+    auto *cache =
+        reinterpret_cast<ngx_weserv_resolver_cache_t *>(shm_zone->data);
+
+    // Reuse the cached host names on reload
+    if (ocache != nullptr) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = reinterpret_cast<ngx_slab_pool_t *>(shm_zone->shm.addr);
+
+    if (shm_zone->shm.exists) {
+        cache->sh = reinterpret_cast<ngx_weserv_resolver_shctx_t *>(
+            cache->shpool->data);
+
+        return NGX_OK;
+    }
+
+    cache->sh = reinterpret_cast<ngx_weserv_resolver_shctx_t *>(
+        ngx_slab_alloc(cache->shpool, sizeof(ngx_weserv_resolver_shctx_t)));
+    if (cache->sh == nullptr) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    size_t len =
+        sizeof(" in weserv resolver cache \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx =
+        reinterpret_cast<u_char *>(ngx_slab_alloc(cache->shpool, len));
+    if (cache->shpool->log_ctx == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in weserv resolver cache \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    // The least recently used host names are evicted when the zone is full
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+ngx_weserv_resolver_node_t *
+ngx_weserv_resolver_cache_lookup_locked(ngx_weserv_resolver_cache_t *cache,
+                                        ngx_str_t *name) {
+    uint32_t hash = ngx_crc32_short(name->data, name->len);
+
+    return reinterpret_cast<ngx_weserv_resolver_node_t *>(
+        ngx_str_rbtree_lookup(&cache->sh->rbtree, name, hash));
+}
+
+/**
+ * Evict the least recently used host names, to make room for a new one.
+ */
+void ngx_weserv_resolver_cache_evict_locked(
+    ngx_weserv_resolver_cache_t *cache) {
+    for (ngx_uint_t n = 0; n < 2; ++n) {
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
+
+        ngx_queue_t *q = ngx_queue_last(&cache->sh->queue);
+        ngx_queue_remove(q);
+
+        auto *node = ngx_queue_data(q, ngx_weserv_resolver_node_t, queue);
+
+        ngx_rbtree_delete(&cache->sh->rbtree, &node->sn.node);
+
+        ngx_slab_free_locked(cache->shpool, node);
+    }
+}
+
+/**
+ * Cache the addresses of a resolved host name, or that it doesn't exist.
+ */
+void ngx_weserv_resolver_cache_store(ngx_weserv_resolver_cache_t *cache,
+                                     ngx_resolver_ctx_t *rctx) {
+    time_t now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ngx_weserv_resolver_node_t *node =
+        ngx_weserv_resolver_cache_lookup_locked(cache, &rctx->name);
+
+    if (node == nullptr) {
+        size_t size = offsetof(ngx_weserv_resolver_node_t, data) +
+                      rctx->name.len;
+
+        node = reinterpret_cast<ngx_weserv_resolver_node_t *>(
+            ngx_slab_alloc_locked(cache->shpool, size));
+
+        if (node == nullptr) {
+            ngx_weserv_resolver_cache_evict_locked(cache);
+
+            node = reinterpret_cast<ngx_weserv_resolver_node_t *>(
+                ngx_slab_alloc_locked(cache->shpool, size));
+
+            if (node == nullptr) {
+                ngx_shmtx_unlock(&cache->shpool->mutex);
+                return;
+            }
+        }
+
+        ngx_memcpy(node->data, rctx->name.data, rctx->name.len);
+
+        node->sn.node.key = ngx_crc32_short(rctx->name.data, rctx->name.len);
+        node->sn.str.data = node->data;
+        node->sn.str.len = rctx->name.len;
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &node->sn.node);
+    } else {
+        ngx_queue_remove(&node->queue);
+    }
+
+    ngx_queue_insert_head(&cache->sh->queue, &node->queue);
+
+    node->updating = 0;
+
+    if (rctx->state) {
+        node->expires = now + cache->negative;
+        node->state = rctx->state;
+        node->naddrs = 0;
+    } else {
+        // The addresses are valid for as long as their TTL says
+        node->expires = std::max(rctx->valid, now);
+        node->state = 0;
+        node->naddrs = std::min(rctx->naddrs, MAX_ADDRS);
+
+        for (ngx_uint_t i = 0; i < node->naddrs; ++i) {
+            node->addrs[i].socklen = rctx->addrs[i].socklen;
+            ngx_memcpy(&node->addrs[i].sockaddr, rctx->addrs[i].sockaddr,
+                       rctx->addrs[i].socklen);
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+/**
+ * Copy a resolved address of the origin, along with its port.
+ * Reference: ngx_http_upstream_create_round_robin_peer
+ */
+ngx_int_t ngx_weserv_copy_addr(ngx_pool_t *pool, in_port_t port,
+                               const struct sockaddr *sockaddr,
+                               socklen_t socklen, ngx_resolver_addr_t *addr) {
+    auto *copy = reinterpret_cast<struct sockaddr *>(ngx_palloc(pool, socklen));
+    if (copy == nullptr) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(copy, sockaddr, socklen);
+    ngx_inet_set_port(copy, port);
+
+    auto *name =
+        reinterpret_cast<u_char *>(ngx_pnalloc(pool, NGX_SOCKADDR_STRLEN));
+    if (name == nullptr) {
+        return NGX_ERROR;
+    }
+
+    addr->sockaddr = copy;
+    addr->socklen = socklen;
+    addr->name.data = name;
+    addr->name.len = ngx_sock_ntop(copy, socklen, name, NGX_SOCKADDR_STRLEN, 1);
+
+    return NGX_OK;
+}
+
+/**
+ * Look up the host name of the origin in the resolver cache, its addresses
+ * are copied to `ur` on a hit.
+ * @param refresh Set if the (stale) addresses should be refreshed; only a
+ *                single worker process is asked to do so.
+ * @param state Set to the resolver error of a negative entry.
+ */
+CacheResult ngx_weserv_resolver_cache_lookup(ngx_weserv_resolver_cache_t *cache,
+                                             ngx_http_request_t *r,
+                                             ngx_str_t *name,
+                                             ngx_http_upstream_resolved_t *ur,
+                                             bool *refresh, ngx_int_t *state) {
+    auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_http_core_module));
+
+    time_t now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    ngx_weserv_resolver_node_t *node =
+        ngx_weserv_resolver_cache_lookup_locked(cache, name);
+
+    if (node == nullptr) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return CacheResult::Miss;
+    }
+
+    if (node->naddrs == 0) {
+        *state = node->state;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return now < node->expires ? CacheResult::Negative : CacheResult::Miss;
+    }
+
+    if (now >= node->expires + cache->stale) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return CacheResult::Miss;
+    }
+
+    CacheResult result = CacheResult::Hit;
+
+    if (now >= node->expires) {
+        result = CacheResult::Stale;
+
+        // Refresh it in the background, unless that's already in flight
+        if (node->updating <= now) {
+            node->updating = now + clcf->resolver_timeout / 1000 + 1;
+            *refresh = true;
+        }
+    }
+
+    ngx_queue_remove(&node->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &node->queue);
+
+    auto *addrs = reinterpret_cast<ngx_resolver_addr_t *>(
+        ngx_pcalloc(r->pool, node->naddrs * sizeof(ngx_resolver_addr_t)));
+    if (addrs == nullptr) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return CacheResult::Miss;
+    }
+
+    for (ngx_uint_t i = 0; i < node->naddrs; ++i) {
+        if (ngx_weserv_copy_addr(r->pool, ur->port,
+                                 &node->addrs[i].sockaddr.sockaddr,
+                                 node->addrs[i].socklen,
+                                 &addrs[i]) != NGX_OK) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return CacheResult::Miss;
+        }
+    }
+
+    ur->addrs = addrs;
+    ur->naddrs = node->naddrs;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return result;
+}
+
+void ngx_weserv_resolver_refresh_handler(ngx_resolver_ctx_t *rctx) {
+    auto *refresh = reinterpret_cast<ngx_weserv_resolver_refresh_t *>(
+        rctx->data);
+
+    // On other errors (e.g. a timeout), the stale addresses are kept until
+    // the refresh is retried
+    if (rctx->state == 0 || rctx->state == NGX_RESOLVE_NXDOMAIN) {
+        ngx_weserv_resolver_cache_store(refresh->cache, rctx);
+    }
+
+    ngx_resolve_name_done(rctx);
+
+    ngx_free(refresh);
+}
+
+/**
+ * Refresh a cached host name in the background, not bound to a request.
+ */
+void ngx_weserv_resolver_refresh(ngx_weserv_resolver_cache_t *cache,
+                                 ngx_http_request_t *r,
+                                 const ngx_str_t &name) {
+    auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_http_core_module));
+
+    auto *refresh = reinterpret_cast<ngx_weserv_resolver_refresh_t *>(
+        ngx_alloc(sizeof(ngx_weserv_resolver_refresh_t) + name.len,
+                  ngx_cycle->log));
+    if (refresh == nullptr) {
+        return;
+    }
+
+    refresh->cache = cache;
+    refresh->name.data = reinterpret_cast<u_char *>(refresh + 1);
+    refresh->name.len = name.len;
+    ngx_memcpy(refresh->name.data, name.data, name.len);
+
+    ngx_resolver_ctx_t temp;
+    temp.name = refresh->name;
+
+    ngx_resolver_ctx_t *rctx = ngx_resolve_start(clcf->resolver, &temp);
+    if (rctx == nullptr ||
+        rctx == reinterpret_cast<ngx_resolver_ctx_t *>(NGX_NO_RESOLVER)) {
+        ngx_free(refresh);
+        return;
+    }
+
+    rctx->name = refresh->name;
+    rctx->handler = ngx_weserv_resolver_refresh_handler;
+    rctx->data = refresh;
+    rctx->timeout = clcf->resolver_timeout;
+
+#if nginx_version >= 1013000
+    // Don't hold back a worker process that's shutting down
+    rctx->cancelable = 1;
+#endif
+
+    if (ngx_resolve_name(rctx) != NGX_OK) {
+        ngx_free(refresh);
+    }
+}
+
+/**
+ * Copy the resolved addresses of the origin.
+ */
+ngx_int_t ngx_weserv_upstream_copy_addrs(ngx_pool_t *pool,
+                                         ngx_http_upstream_resolved_t *ur,
+                                         ngx_resolver_ctx_t *rctx) {
+    auto *addrs = reinterpret_cast<ngx_resolver_addr_t *>(
+        ngx_pcalloc(pool, rctx->naddrs * sizeof(ngx_resolver_addr_t)));
+    if (addrs == nullptr) {
+        return NGX_ERROR;
+    }
+
+    for (ngx_uint_t i = 0; i < rctx->naddrs; ++i) {
+        if (ngx_weserv_copy_addr(pool, ur->port, rctx->addrs[i].sockaddr,
+                                 rctx->addrs[i].socklen,
+                                 &addrs[i]) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    ur->addrs = addrs;
+    ur->naddrs = rctx->naddrs;
+
+    return NGX_OK;
+}
+
+/**
+ * Called once the host name of the origin is resolved, or failed to.
+ * Reference: ngx_http_upstream_resolve_handler
+ */
+void ngx_weserv_upstream_resolve_handler(ngx_resolver_ctx_t *rctx) {
+    auto *r = reinterpret_cast<ngx_http_request_t *>(rctx->data);
+    ngx_connection_t *c = r->connection;
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    auto *ctx = reinterpret_cast<ngx_weserv_upstream_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+
+    ngx_http_upstream_resolved_t *ur = ctx->resolved;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ctx->resolve_time += ngx_current_msec - ctx->resolve_start;
+
+    if (mc->resolver_cache != nullptr &&
+        (rctx->state == 0 || rctx->state == NGX_RESOLVE_NXDOMAIN)) {
+        ngx_weserv_resolver_cache_store(mc->resolver_cache, rctx);
+    }
+
+    ngx_int_t rc = NGX_OK;
+
+    if (rctx->state) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "%V could not be resolved (%i: %s)", &rctx->name,
+                      rctx->state, ngx_resolver_strerror(rctx->state));
+
+        rc = NGX_HTTP_BAD_GATEWAY;
+    } else if (ngx_weserv_upstream_copy_addrs(r->pool, ur, rctx) != NGX_OK) {
+        rc = NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_resolve_name_done(rctx);
+    ur->ctx = nullptr;
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_init(r);
+    } else {
+        ctx->response_status = Status(rc, "Failed to connect to server",
+                                      Status::ErrorCause::Upstream);
+
+        // Reset redirect flag
+        ctx->redirecting = 0;
+
+        ngx_http_finalize_request(r, rc);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+/**
+ * Release a pending resolution once the request is freed.
+ */
+void ngx_weserv_upstream_resolve_cleanup(void *data) {
+    auto *ur = reinterpret_cast<ngx_http_upstream_resolved_t *>(data);
+
+    if (ur->ctx != nullptr) {
+        ngx_resolve_name_done(ur->ctx);
+        ur->ctx = nullptr;
+    }
+}
+
+}  // namespace
+
+ngx_weserv_resolver_cache_t *
+ngx_weserv_resolver_cache_create(ngx_conf_t *cf, size_t size, time_t stale,
+                                 time_t negative) {
+    static ngx_str_t name = ngx_string("weserv_resolver_cache");
+
+    auto *cache = reinterpret_cast<ngx_weserv_resolver_cache_t *>(
+        ngx_pcalloc(cf->pool, sizeof(ngx_weserv_resolver_cache_t)));
+    if (cache == nullptr) {
+        return nullptr;
+    }
+
+    cache->stale = stale;
+    cache->negative = negative;
+
+    ngx_shm_zone_t *shm_zone =
+        ngx_shared_memory_add(cf, &name, size, &ngx_weserv_module);
+    if (shm_zone == nullptr) {
+        return nullptr;
+    }
+
+    shm_zone->init = ngx_weserv_resolver_cache_init_zone;
+    shm_zone->data = cache;
+
+    return cache;
+}
+
+/**
+ * Reference: ngx_http_upstream_init_request
+ */
+Status ngx_weserv_resolve(ngx_http_request_t *r,
+                          ngx_weserv_upstream_ctx_t *ctx) {
+    ngx_http_upstream_resolved_t *ur = ctx->resolved;
+
+    auto *mc = reinterpret_cast<ngx_weserv_main_conf_t *>(
+        ngx_http_get_module_main_conf(r, ngx_weserv_module));
+
+    auto *clcf = reinterpret_cast<ngx_http_core_loc_conf_t *>(
+        ngx_http_get_module_loc_conf(r, ngx_http_core_module));
+
+    // Host names are cached (and resolved) in lowercase
+    ngx_str_t name;
+    name.len = ur->host.len;
+    name.data = reinterpret_cast<u_char *>(ngx_pnalloc(r->pool, name.len));
+    if (name.data == nullptr) {
+        return Status(NGX_ERROR, "Out of memory");
+    }
+
+    ngx_strlow(name.data, ur->host.data, name.len);
+
+    ctx->resolve_start = ngx_current_msec;
+
+    if (mc->resolver_cache != nullptr) {
+        bool refresh = false;
+        ngx_int_t state = 0;
+
+        CacheResult result = ngx_weserv_resolver_cache_lookup(
+            mc->resolver_cache, r, &name, ur, &refresh, &state);
+
+        if (refresh) {
+            ngx_weserv_resolver_refresh(mc->resolver_cache, r, name);
+        }
+
+        if (result == CacheResult::Negative) {
+            ngx_str_set(&ctx->resolve_status, "NEGATIVE");
+
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "%V could not be resolved (%i: %s), cached",
+                          &ur->host, state, ngx_resolver_strerror(state));
+
+            return Status(NGX_HTTP_BAD_GATEWAY, "Failed to connect to server",
+                          Status::ErrorCause::Upstream);
+        }
+
+        if (result != CacheResult::Miss) {
+            if (result == CacheResult::Hit) {
+                ngx_str_set(&ctx->resolve_status, "HIT");
+            } else {
+                ngx_str_set(&ctx->resolve_status, "STALE");
+            }
+
+            r->main->count++;
+
+            ngx_http_upstream_init(r);
+
+            return Status::OK;
+        }
+    }
+
+    ngx_str_set(&ctx->resolve_status, "MISS");
+
+    ngx_pool_cleanup_t *cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == nullptr) {
+        return Status(NGX_ERROR, "Out of memory");
+    }
+
+    cln->handler = ngx_weserv_upstream_resolve_cleanup;
+    cln->data = ur;
+
+    ngx_resolver_ctx_t temp;
+    temp.name = name;
+
+    ngx_resolver_ctx_t *rctx = ngx_resolve_start(clcf->resolver, &temp);
+    if (rctx == nullptr) {
+        return Status(NGX_ERROR, "Out of memory");
+    }
+
+    if (rctx == reinterpret_cast<ngx_resolver_ctx_t *>(NGX_NO_RESOLVER)) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "no resolver defined to resolve %V", &ur->host);
+
+        return Status(NGX_HTTP_BAD_GATEWAY, "Failed to connect to server",
+                      Status::ErrorCause::Upstream);
+    }
+
+    rctx->name = name;
+    rctx->handler = ngx_weserv_upstream_resolve_handler;
+    rctx->data = r;
+    rctx->timeout = clcf->resolver_timeout;
+
+    ur->ctx = rctx;
+
+    // The resolve handler may be called right away
+    r->main->count++;
+
+    if (ngx_resolve_name(rctx) != NGX_OK) {
+        ur->ctx = nullptr;
+        r->main->count--;
+
+        return Status(NGX_ERROR, "Failed to resolve the host name");
+    }
+
+    return Status::OK;
+}
+
+}  // namespace nginx
+}  // namespace weserv
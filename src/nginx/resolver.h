@@ -0,0 +1,44 @@
+#pragma once
+
+extern "C" {
+#include <ngx_http.h>
+}
+
+#include <weserv/utils/status.h>
+
+namespace weserv {
+namespace nginx {
+
+struct ngx_weserv_upstream_ctx_t;
+
+/**
+ * The resolved addresses of origin servers, cached in shared memory across
+ * worker processes. Expired addresses are still used for a while (see
+ * `stale`) while they are refreshed in the background, and host names that
+ * don't exist are cached as well (see `negative`).
+ */
+struct ngx_weserv_resolver_cache_t;
+
+/**
+ * Create the resolver cache.
+ * @param cf The configuration.
+ * @param size The size of the shared memory zone.
+ * @param stale For how long expired addresses may still be used, in seconds.
+ * @param negative For how long nonexistent host names are cached, in
+ *                 seconds.
+ * @return The cache, or nullptr on error.
+ */
+ngx_weserv_resolver_cache_t *
+ngx_weserv_resolver_cache_create(ngx_conf_t *cf, size_t size, time_t stale,
+                                 time_t negative);
+
+/**
+ * Resolve the host name of the origin, through the resolver cache if
+ * configured. The upstream is initialized once it's resolved (possibly
+ * right away).
+ */
+api::utils::Status ngx_weserv_resolve(ngx_http_request_t *r,
+                                      ngx_weserv_upstream_ctx_t *ctx);
+
+}  // namespace nginx
+}  // namespace weserv
@@ -1,17 +1,119 @@
 #include "stream.h"
 
+#include "alloc.h"
+#include "error.h"
 #include "header.h"
-#include "util.h"
 
 namespace weserv {
 namespace nginx {
 
 ngx_str_t application_json = ngx_string("application/json");
 
+ngx_str_t text_plain = ngx_string("text/plain");
+
+ngx_str_t vary_accept = ngx_string("Accept");
+
 // 1 year by default.
 // See: https://github.com/weserv/images/issues/186
 const time_t MAX_AGE_DEFAULT = 60 * 60 * 24 * 365;
 
+#if (NGX_THREADS)
+// The size of the output buffers of a streamed response, like the default
+// of `output_buffers`
+const size_t OUTPUT_BUFFER_SIZE = 32 * 1024;
+
+// The number of output buffers of a streamed response, this bounds its
+// memory usage to 128 KiB
+const ngx_uint_t STREAM_BUFFERS = 4;
+
+// How often the event loop polls for the output of a streamed response
+const ngx_msec_t STREAM_POLL_INTERVAL = 10;
+#endif
+
+namespace {
+
+/**
+ * Set the response headers of an image.
+ * @param content_length The content length, or -1 if unknown.
+ */
+void set_image_headers(ngx_http_request_t *r, const std::string &extension,
+                       bool base64, off_t content_length) {
+    ngx_str_t mime_type = extension_to_mime_type(extension);
+
+    // A data URI is sent as plain text
+    if (base64) {
+        mime_type = text_plain;
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_type = mime_type;
+    r->headers_out.content_type_len = mime_type.len;
+    r->headers_out.content_type_lowcase = nullptr;
+    r->headers_out.content_length_n = content_length;
+
+    if (r->headers_out.content_length) {
+        r->headers_out.content_length->hash = 0;
+    }
+
+    r->headers_out.content_length = nullptr;
+
+    // Set the content disposition header to images only
+    if (!base64 && !ngx_string_equal(mime_type, application_json)) {
+        (void)set_content_disposition_header(r, extension);
+    }
+
+    set_cache_headers(r);
+}
+
+#if (NGX_THREADS)
+/**
+ * The target of a streamed image, see NgxStream.
+ */
+class NgxStreamTarget : public api::io::TargetInterface {
+ public:
+    explicit NgxStreamTarget(NgxStream *stream) : stream_(stream) {}
+
+    ~NgxStreamTarget() override = default;
+
+    void setup(const std::string &extension) override {
+        stream_->setup(extension);
+    }
+
+    int64_t write(const void *data, size_t length) override {
+        return stream_->write(data, length);
+    }
+
+    void finish() override {
+        stream_->finish();
+    }
+
+ private:
+    NgxStream *stream_;
+};
+#endif
+
+}  // namespace
+
+void set_cache_headers(ngx_http_request_t *r) {
+    // The image format depends on the Accept request header
+    if (is_auto_output_needed(r)) {
+        (void)set_vary_header(r, &vary_accept);
+    }
+
+    time_t max_age = MAX_AGE_DEFAULT;
+
+    ngx_str_t max_age_str;
+    if (ngx_http_arg(r, (u_char *)"maxage", 6, &max_age_str) == NGX_OK) {
+        max_age = parse_max_age(max_age_str);
+        if (max_age == static_cast<time_t>(NGX_ERROR)) {
+            max_age = MAX_AGE_DEFAULT;
+        }
+    }
+
+    // Only set Cache-Control and Expires headers on non-error responses
+    (void)set_expires_header(r, max_age);
+}
+
 int64_t NgxSource::read(void *data, size_t length) {
     size_t bytes_read = 0;
 
@@ -38,20 +140,49 @@ int64_t NgxSource::read(void *data, size_t length) {
 
 void NgxTarget::setup(const std::string &extension) {
     extension_ = extension;
+
+    // The prefix of the data URI is emitted up front
+    if (base64_) {
+        std::string prefix =
+            "data:" + ngx_str_to_std(extension_to_mime_type(extension_)) +
+            ";base64,";
+
+        (void)append(reinterpret_cast<const u_char *>(prefix.data()),
+                     prefix.size(), false);
+    }
 }
 
 int64_t NgxTarget::write(const void *data, size_t length) {
-    ngx_buf_t *b = ngx_create_temp_buf(r_->pool, length);
-    if (b == nullptr) {
+    if (!append(static_cast<const u_char *>(data), length, base64_)) {
         return -1;
     }
 
-    b->last = ngx_cpymem(b->last, data, length);
-    b->last_buf = 1;
+    return length;
+}
+
+bool NgxTarget::append(const u_char *data, size_t length, bool encode) {
+    size_t size = encode ? encoder_.encoded_length(length) : length;
+
+    // Too little to encode, it's held back by the encoder
+    if (size == 0) {
+        if (encode) {
+            (void)encoder_.encode(data, length, nullptr);
+        }
+
+        return true;
+    }
+
+    ngx_buf_t *b = ngx_create_temp_buf(r_->pool, size);
+    if (b == nullptr) {
+        return false;
+    }
+
+    b->last = encode ? b->last + encoder_.encode(data, length, b->last)
+                     : ngx_cpymem(b->last, data, length);
 
     ngx_chain_t *cl = ngx_alloc_chain_link(r_->pool);
     if (cl == nullptr) {
-        return -1;
+        return false;
     }
 
     cl->buf = b;
@@ -60,47 +191,413 @@ int64_t NgxTarget::write(const void *data, size_t length) {
     *ll_ = cl;
     ll_ = &cl->next;
 
-    content_length_ += length;
+    buf_ = b;
+    content_length_ += size;
 
-    return length;
+    return true;
 }
 
 void NgxTarget::finish() {
-    ngx_str_t mime_type = extension_to_mime_type(extension_);
+    if (base64_) {
+        u_char padding[4];
+        size_t size = encoder_.finish(padding);
 
-    r_->headers_out.status = NGX_HTTP_OK;
-    r_->headers_out.content_type = mime_type;
-    r_->headers_out.content_type_len = mime_type.len;
-    r_->headers_out.content_type_lowcase = nullptr;
-    r_->headers_out.content_length_n = content_length_;
+        if (size != 0 && !append(padding, size, false)) {
+            return;
+        }
+    }
 
-    if (r_->headers_out.content_length) {
-        r_->headers_out.content_length->hash = 0;
+    if (buf_ != nullptr) {
+        buf_->last_buf = 1;
+        buf_->last_in_chain = 1;
     }
 
-    r_->headers_out.content_length = nullptr;
+    set_image_headers(r_, extension_, base64_, content_length_);
+}
 
-    // Set the content disposition header to images only
-    if (!is_base64_needed(r_) &&
-        !ngx_string_equal(mime_type, application_json)) {
-        (void)set_content_disposition_header(r_, extension_);
+#if (NGX_THREADS)
+bool NgxStream::is_possible(ngx_http_request_t *r,
+                            ngx_weserv_loc_conf_t *lc) {
+    if (lc->thread_pool == nullptr) {
+        return false;
     }
 
-    time_t max_age = MAX_AGE_DEFAULT;
+    // HTTP/1.x only, the output of HTTP/2 streams is buffered
+#if (NGX_HTTP_V2)
+    if (r->stream != nullptr) {
+        return false;
+    }
+#endif
 
-    ngx_str_t max_age_str;
-    if (ngx_http_arg(r_, (u_char *)"maxage", 6, &max_age_str) == NGX_OK) {
-        max_age = parse_max_age(max_age_str);
-        if (max_age == static_cast<time_t>(NGX_ERROR)) {
-            max_age = MAX_AGE_DEFAULT;
+    return true;
+}
+
+ngx_int_t NgxStream::post(ngx_http_request_t *r, ngx_weserv_loc_conf_t *lc,
+                          Process process) {
+    auto *stream = register_pool_cleanup(
+        r->pool, new (r->pool) NgxStream(r, std::move(process)));
+    if (stream == nullptr) {
+        return NGX_ERROR;
+    }
+
+    auto tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
+
+    // The output buffers are allocated up front, the processing thread
+    // can't allocate from the request pool
+    for (ngx_uint_t i = 0; i < STREAM_BUFFERS; ++i) {
+        ngx_chain_t *cl = ngx_alloc_chain_link(r->pool);
+        if (cl == nullptr) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ngx_create_temp_buf(r->pool, OUTPUT_BUFFER_SIZE);
+        if (cl->buf == nullptr) {
+            return NGX_ERROR;
         }
+
+        cl->buf->tag = tag;
+
+        cl->next = stream->free_;
+        stream->free_ = cl;
     }
 
-    // Only set Cache-Control and Expires headers on non-error responses
-    (void)set_expires_header(r_, max_age);
+    ngx_thread_task_t *task = ngx_thread_task_alloc(r->pool, 0);
+    if (task == nullptr) {
+        return NGX_ERROR;
+    }
+
+    task->ctx = stream;
+    task->handler = run;
+    task->event.data = stream;
+    task->event.handler = done_handler;
+
+    if (ngx_thread_task_post(lc->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_event_t *ev = &stream->poll_event_;
+    ev->data = stream;
+    ev->handler = poll_handler;
+    ev->log = r->connection->log;
+
+    ngx_add_timer(ev, STREAM_POLL_INTERVAL);
+
+    // Like aio threads, the request can't be freed until it's processed
+    r->main->blocked++;
+    r->connection->buffered |= NGX_WESERV_IMAGE_BUFFERED;
+
+    return NGX_AGAIN;
+}
+
+void NgxStream::run(void *data, ngx_log_t * /* unused */) {
+    auto *stream = reinterpret_cast<NgxStream *>(data);
+
+    stream->status_ = stream->process_(
+        std::unique_ptr<api::io::TargetInterface>(new NgxStreamTarget(stream)));
+}
+
+void NgxStream::setup(const std::string &extension) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        extension_ = extension;
+    }
+
+    // The prefix of the data URI is emitted up front
+    if (base64_) {
+        std::string prefix =
+            "data:" + ngx_str_to_std(extension_to_mime_type(extension)) +
+            ";base64,";
+
+        (void)append(reinterpret_cast<const u_char *>(prefix.data()),
+                     prefix.size(), false);
+    }
+}
+
+int64_t NgxStream::write(const void *data, size_t length) {
+    if (!append(static_cast<const u_char *>(data), length, base64_)) {
+        return -1;
+    }
+
+    return length;
+}
+
+void NgxStream::finish() {
+    if (base64_) {
+        u_char padding[4];
+        size_t size = encoder_.finish(padding);
+
+        if (size != 0 && !append(padding, size, false)) {
+            return;
+        }
+    }
+
+    if (cl_ != nullptr) {
+        ready_buffer();
+    }
+}
+
+bool NgxStream::append(const u_char *data, size_t length, bool encode) {
+    while (length > 0) {
+        if (cl_ == nullptr && !acquire_buffer()) {
+            return false;
+        }
+
+        ngx_buf_t *b = cl_->buf;
+        size_t room = b->end - b->last;
+
+        if (encode) {
+            // Encode as much as fits, in groups of three bytes
+            size_t fits = room / 4 * 3;
+            size_t size =
+                fits > encoder_.pending()
+                    ? ngx_min(length, fits - encoder_.pending())
+                    : 0;
+
+            b->last += encoder_.encode(data, size, b->last);
+            data += size;
+            length -= size;
+
+            // No room for another group, consider the buffer full
+            if (size == 0) {
+                room = 0;
+            }
+        } else {
+            size_t size = ngx_min(length, room);
+
+            b->last = ngx_cpymem(b->last, data, size);
+            data += size;
+            length -= size;
+        }
+
+        if (room == 0 || b->last == b->end) {
+            ready_buffer();
+        }
+    }
+
+    return true;
+}
+
+bool NgxStream::acquire_buffer() {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cond_.wait(lock, [this] { return free_ != nullptr || aborted_; });
+
+    if (aborted_) {
+        return false;
+    }
+
+    cl_ = free_;
+    free_ = free_->next;
+    cl_->next = nullptr;
+
+    return true;
+}
+
+void NgxStream::ready_buffer() {
+    // Nothing was appended (e.g. held back by the base64 encoder)
+    if (cl_->buf->last == cl_->buf->pos) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    *ready_ll_ = cl_;
+    ready_ll_ = &cl_->next;
+    cl_ = nullptr;
+}
+
+void NgxStream::release_buffers(ngx_chain_t *free) {
+    ngx_chain_t *last = free;
+    while (last->next) {
+        last = last->next;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    last->next = free_;
+    free_ = free;
+
+    cond_.notify_one();
+}
+
+void NgxStream::abort() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    aborted_ = true;
+
+    cond_.notify_one();
+}
+
+void NgxStream::poll_handler(ngx_event_t *ev) {
+    auto *stream = reinterpret_cast<NgxStream *>(ev->data);
+
+    // The client is gone (or timed out), stop processing
+    if (stream->r_->connection->error || stream->send(false) == NGX_ERROR) {
+        stream->abort();
+        return;
+    }
+
+    ngx_add_timer(ev, STREAM_POLL_INTERVAL);
+}
+
+void NgxStream::done_handler(ngx_event_t *ev) {
+    auto *stream = reinterpret_cast<NgxStream *>(ev->data);
+    ngx_http_request_t *r = stream->r_;
+    ngx_connection_t *c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    if (stream->poll_event_.timer_set) {
+        ngx_del_timer(&stream->poll_event_);
+    }
+
+    r->main->blocked--;
+    c->buffered &= ~NGX_WESERV_IMAGE_BUFFERED;
+
+    // Release the buffered upstream image as soon as it's processed
+    auto *ctx = reinterpret_cast<ngx_weserv_base_ctx_t *>(
+        ngx_http_get_module_ctx(r, ngx_weserv_module));
+    if (ctx != nullptr) {
+        ngx_weserv_image_filter_free_buf(r, ctx);
+    }
+
+    // Note: the request might be freed from here on, and the stream with it
+    if (stream->complete() == NGX_ERROR) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+    } else {
+        r->write_event_handler(r);
+    }
+
+    ngx_http_run_posted_requests(c);
+}
+
+ngx_int_t NgxStream::send(bool last) {
+    ngx_chain_t *out;
+    std::string extension;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        out = ready_;
+        ready_ = nullptr;
+        ready_ll_ = &ready_;
+
+        extension = extension_;
+    }
+
+    ngx_chain_t **ll = &out;
+    off_t size = 0;
+
+    for (ngx_chain_t *cl = out; cl; cl = cl->next) {
+        size += ngx_buf_size(cl->buf);
+        ll = &cl->next;
+    }
+
+    if (last) {
+        ngx_chain_t *cl = ngx_alloc_chain_link(r_->pool);
+        if (cl == nullptr) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = ngx_calloc_buf(r_->pool);
+        if (cl->buf == nullptr) {
+            return NGX_ERROR;
+        }
+
+        cl->buf->last_buf = 1;
+        cl->buf->last_in_chain = 1;
+        cl->next = nullptr;
+
+        *ll = cl;
+    }
+
+    // Nothing to send (yet)
+    if (out == nullptr && busy_ == nullptr) {
+        return NGX_OK;
+    }
+
+    if (!r_->header_sent) {
+        // The content length is known if this is all of the output
+        set_image_headers(r_, extension, base64_, last ? size : -1);
+
+        ngx_int_t rc = ngx_http_next_header_filter(r_);
+        if (rc == NGX_ERROR || rc > NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    auto tag = reinterpret_cast<ngx_buf_tag_t>(&ngx_weserv_module);
+    ngx_chain_t *free = nullptr;
+
+    // A HEAD request, the output is discarded after the headers
+    if (r_->header_only) {
+        while (out) {
+            ngx_chain_t *cl = out;
+            out = out->next;
+
+            // The empty last buffer isn't ours
+            if (cl->buf->tag != tag) {
+                ngx_free_chain(r_->pool, cl);
+                continue;
+            }
+
+            cl->buf->pos = cl->buf->start;
+            cl->buf->last = cl->buf->start;
+
+            cl->next = free;
+            free = cl;
+        }
+
+        if (free != nullptr) {
+            release_buffers(free);
+        }
+
+        return NGX_OK;
+    }
+
+    ngx_int_t rc = ngx_http_next_body_filter(r_, out);
+
+    // The buffers that are sent can be reused for the next output
+    ngx_chain_update_chains(r_->pool, &free, &busy_, &out, tag);
+
+    if (free != nullptr) {
+        release_buffers(free);
+    }
+
+    return rc;
+}
+
+ngx_int_t NgxStream::complete() {
+    if (r_->connection->error) {
+        return NGX_ERROR;
+    }
+
+    if (status_.ok()) {
+        return send(true);
+    }
+
+    // It's too late to respond with an error once the output is (partly)
+    // sent. Close the connection instead, so that the client (or cache)
+    // doesn't mistake the truncated response for a complete one.
+    if (r_->header_sent) {
+        ngx_log_error(NGX_LOG_ERR, r_->connection->log, 0,
+                      "weserv: error while streaming: %s",
+                      status_.message().c_str());
+        return NGX_ERROR;
+    }
+
+    // The validators of a file don't apply to the error
+    ngx_http_clear_last_modified(r_);
+    ngx_http_clear_etag(r_);
+
+    ngx_chain_t error;
+    if (ngx_weserv_return_error(r_, status_, &error) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-    *ll_ = nullptr;
+    return ngx_weserv_finish(r_, &error);
 }
+#endif
 
 }  // namespace nginx
 }  // namespace weserv
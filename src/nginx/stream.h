@@ -7,9 +7,24 @@ extern "C" {
 #include <weserv/io/source_interface.h>
 #include <weserv/io/target_interface.h>
 
+#include "module.h"
+#include "util.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
 namespace weserv {
 namespace nginx {
 
+/**
+ * Set the caching response headers (Vary, Cache-Control and Expires) of an
+ * image, these are sent with a 304 Not Modified response as well.
+ */
+void set_cache_headers(ngx_http_request_t *r);
+
 /**
  * The nginx implementation of io::SourceInterface.
  */
@@ -36,7 +51,12 @@ class NgxSource : public api::io::SourceInterface {
  */
 class NgxTarget : public api::io::TargetInterface {
  public:
-    NgxTarget(ngx_http_request_t *r, ngx_chain_t **out) : r_(r), ll_(out) {}
+    /**
+     * @param r The request.
+     * @param out The chain to output to.
+     */
+    NgxTarget(ngx_http_request_t *r, ngx_chain_t **out)
+        : r_(r), ll_(out), base64_(is_base64_needed(r)) {}
 
     ~NgxTarget() override = default;
 
@@ -47,12 +67,166 @@ class NgxTarget : public api::io::TargetInterface {
     void finish() override;
 
  private:
+    /**
+     * Append to a buffer of its own, linked to the output chain.
+     * @param data The data to append.
+     * @param length The size of the data, in bytes.
+     * @param encode Should the data be base64 encoded?
+     * @return A bool indicating if the data was appended.
+     */
+    bool append(const u_char *data, size_t length, bool encode);
+
     ngx_http_request_t *r_;
     ngx_chain_t **ll_;
 
     std::string extension_;
     off_t content_length_ = 0;
+
+    // Output a `data:` URI with the base64 encoded image (`&encoding=base64`)
+    bool base64_;
+    Base64Encoder encoder_;
+
+    // The last output buffer
+    ngx_buf_t *buf_ = nullptr;
+};
+
+#if (NGX_THREADS)
+/**
+ * Processes an image on the thread pool of the location and streams the
+ * output to the client (with chunked transfer encoding) as it's produced,
+ * `weserv_streaming on`. The output is sent from the event loop, which polls
+ * for it; the processing thread waits for the client once all the output
+ * buffers are in flight.
+ */
+class NgxStream {
+ public:
+    /**
+     * Processes the image to the given target, called on the thread pool.
+     */
+    using Process = std::function<api::utils::Status(
+        std::unique_ptr<api::io::TargetInterface>)>;
+
+    /**
+     * Can the output of the request be streamed? Only if enabled, and only
+     * HTTP/1.x responses are; the output of HTTP/2 streams is buffered.
+     */
+    static bool is_possible(ngx_http_request_t *r,
+                            ngx_weserv_loc_conf_t *lc);
+
+    /**
+     * Post the processing of an image to the thread pool of the location.
+     * The request is blocked (and its connection buffered) until it's done.
+     * @return NGX_AGAIN, or NGX_ERROR.
+     */
+    static ngx_int_t post(ngx_http_request_t *r, ngx_weserv_loc_conf_t *lc,
+                          Process process);
+
+    NgxStream(ngx_http_request_t *r, Process process)
+        : r_(r), process_(std::move(process)), status_(NGX_OK, ""),
+          base64_(is_base64_needed(r)), poll_event_() {}
+
+    /**
+     * The target implementation, called on the thread pool (or the
+     * write-behind thread of libvips).
+     */
+    void setup(const std::string &extension);
+
+    int64_t write(const void *data, size_t length);
+
+    void finish();
+
+ private:
+    /**
+     * Run the process, on the thread pool.
+     */
+    static void run(void *data, ngx_log_t *log);
+
+    /**
+     * Send the output produced so far, on the event loop.
+     */
+    static void poll_handler(ngx_event_t *ev);
+
+    /**
+     * Send the rest of the output (or the error), on the event loop once
+     * the image is processed.
+     */
+    static void done_handler(ngx_event_t *ev);
+
+    /**
+     * Append to the output buffer being filled, which is handed over to the
+     * event loop once full.
+     * @return A bool indicating if the data was appended, false once the
+     *         stream is aborted.
+     */
+    bool append(const u_char *data, size_t length, bool encode);
+
+    /**
+     * Take a free output buffer, waits for the client if there are none.
+     * @return false if the stream is aborted.
+     */
+    bool acquire_buffer();
+
+    /**
+     * Hand the output buffer being filled over to the event loop.
+     */
+    void ready_buffer();
+
+    /**
+     * Give sent output buffers back to the processing thread.
+     */
+    void release_buffers(ngx_chain_t *free);
+
+    /**
+     * Stop waiting for the client, the processing fails.
+     */
+    void abort();
+
+    /**
+     * Send the ready output buffers to the next body filter, preceded by
+     * the response headers if not yet sent.
+     * @param last Is this the end of the output?
+     * @return NGX_OK, NGX_AGAIN or NGX_ERROR.
+     */
+    ngx_int_t send(bool last);
+
+    /**
+     * Send the rest of the output, or the error if nothing was sent yet.
+     * @return NGX_OK, NGX_AGAIN or NGX_ERROR.
+     */
+    ngx_int_t complete();
+
+    ngx_http_request_t *r_;
+
+    Process process_;
+    api::utils::Status status_;
+
+    // Output a `data:` URI with the base64 encoded image (`&encoding=base64`)
+    bool base64_;
+    Base64Encoder encoder_;
+
+    // The output buffer being filled by the processing thread
+    ngx_chain_t *cl_ = nullptr;
+
+    // Polls for output buffers that are ready to be sent
+    ngx_event_t poll_event_;
+
+    // Output buffers that are being sent (by the event loop)
+    ngx_chain_t *busy_ = nullptr;
+
+    // Guards the members below, shared with the processing thread
+    std::mutex mutex_;
+    std::condition_variable cond_;
+
+    std::string extension_;
+
+    // Output buffers that are ready to be sent, and those that can be reused
+    ngx_chain_t *ready_ = nullptr;
+    ngx_chain_t **ready_ll_ = &ready_;
+    ngx_chain_t *free_ = nullptr;
+
+    bool aborted_ = false;
 };
+#endif
 
 }  // namespace nginx
 }  // namespace weserv
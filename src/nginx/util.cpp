@@ -26,62 +26,119 @@ bool is_base64_needed(ngx_http_request_t *r) {
            ngx_strncasecmp(encoding.data, (u_char *)"base64", 6) == 0;
 }
 
-ngx_int_t output_chain_to_base64(ngx_http_request_t *r, ngx_chain_t *out) {
-    size_t prefix_size = sizeof("data:") - 1;
-    size_t suffix_size = sizeof(";base64,") - 1;
-    off_t content_length = r->headers_out.content_length_n;
+bool is_auto_output_needed(ngx_http_request_t *r) {
+    ngx_str_t output;
+    if (ngx_http_arg(r, (u_char *)"output", 6, &output) != NGX_OK) {
+        return false;
+    }
 
-    ngx_str_t src;
-    src.data = reinterpret_cast<u_char *>(ngx_palloc(r->pool, content_length));
-    u_char *p = src.data;
+    // Case-sensitive, like the API parses the output format
+    return output.len == 4 && ngx_strncmp(output.data, "auto", 4) == 0;
+}
 
-    for (ngx_chain_t *cl = out; cl; cl = cl->next) {
-        ngx_buf_t *b = cl->buf;
-        size_t size = b->last - b->pos;
+namespace {
 
-        size_t rest = src.data + content_length - p;
+/**
+ * Trim the leading and trailing whitespace of a string.
+ */
+std::string trim_whitespace(const std::string &str) {
+    size_t first = str.find_first_not_of(" \t");
+    if (first == std::string::npos) {
+        return "";
+    }
 
-        if (size > rest) {
-            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-                          "weserv image filter: too big response");
-            return NGX_ERROR;
+    size_t last = str.find_last_not_of(" \t");
+    return str.substr(first, last - first + 1);
+}
+
+/**
+ * Does the given media range (for e.g. `image/webp;q=0.8`) accept the
+ * media type?
+ */
+bool is_media_type_accepted(const std::string &range,
+                            const std::string &media_type) {
+    size_t params_pos = range.find(';');
+
+    std::string type = trim_whitespace(range.substr(0, params_pos));
+    if (type.size() != media_type.size() ||
+        !std::equal(type.begin(), type.end(), media_type.begin(),
+                    [](char a, char b) {
+                        return std::tolower(a) == std::tolower(b);
+                    })) {
+        return false;
+    }
+
+    while (params_pos != std::string::npos) {
+        size_t param_end = range.find(';', params_pos + 1);
+
+        std::string param = trim_whitespace(
+            range.substr(params_pos + 1, param_end - params_pos - 1));
+        if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') &&
+            param[1] == '=') {
+            return std::strtod(param.c_str() + 2, nullptr) > 0;
         }
 
-        p = ngx_cpymem(p, b->pos, size);
-        b->pos += size;
+        params_pos = param_end;
     }
 
-    src.len = p - src.data;
+    return true;
+}
+
+}  // namespace
 
-    ngx_str_t dst;
-    int enc_len = ngx_base64_encoded_length(src.len);
-    dst.data = reinterpret_cast<u_char *>(ngx_pcalloc(r->pool, enc_len + 1));
+std::string get_accepted_formats(ngx_http_request_t *r) {
+    bool avif = false;
+    bool webp = false;
 
-    ngx_encode_base64(&dst, &src);
-    dst.data[dst.len] = '\0';
+    ngx_list_part_t *part = &r->headers_in.headers.part;
+    auto *h = reinterpret_cast<ngx_table_elt_t *>(part->elts);
 
-    ngx_str_t mime_type = r->headers_out.content_type;
-    content_length = prefix_size + mime_type.len + suffix_size + dst.len;
+    for (ngx_uint_t i = 0; /* void */; ++i) {
+        if (i >= part->nelts) {
+            if (part->next == nullptr) {
+                break;
+            }
 
-    ngx_buf_t *buf = ngx_create_temp_buf(r->pool, content_length);
-    if (buf == nullptr) {
-        return NGX_ERROR;
-    }
+            part = part->next;
+            h = reinterpret_cast<ngx_table_elt_t *>(part->elts);
+            i = 0;
+        }
+
+        if (h[i].key.len != 6 ||
+            ngx_strncasecmp(h[i].key.data, (u_char *)"accept", 6) != 0) {
+            continue;
+        }
 
-    buf->last_buf = 1;
-    buf->last_in_chain = 1;
-    buf->last = ngx_cpymem(buf->last, "data:", prefix_size);
-    buf->last = ngx_cpymem(buf->last, mime_type.data, mime_type.len);
-    buf->last = ngx_cpymem(buf->last, ";base64,", suffix_size);
-    buf->last = ngx_cpymem(buf->last, dst.data, dst.len);
+        std::string accept = ngx_str_to_std(h[i].value);
 
-    r->headers_out.content_length_n = content_length;
-    r->headers_out.content_type_len = sizeof("text/plain") - 1;
-    ngx_str_set(&r->headers_out.content_type, "text/plain");
+        size_t range_pos = 0;
+        while (range_pos < accept.size()) {
+            size_t range_end = accept.find(',', range_pos);
+            if (range_end == std::string::npos) {
+                range_end = accept.size();
+            }
+
+            std::string range =
+                accept.substr(range_pos, range_end - range_pos);
 
-    *out = {buf, nullptr};
+            avif = avif || is_media_type_accepted(range, "image/avif");
+            webp = webp || is_media_type_accepted(range, "image/webp");
+
+            range_pos = range_end + 1;
+        }
+    }
+
+    // Keep these in order of preference, this string is also
+    // exposed as the $weserv_accept variable (useful as cache key)
+    if (avif && webp) {
+        return "avif,webp";
+    } else if (avif) {
+        return "avif";
+    } else if (webp) {
+        return "webp";
+    }
 
-    return NGX_OK;
+    return "";
 }
 
 time_t parse_max_age(ngx_str_t &s) {
@@ -113,6 +170,10 @@ ngx_str_t extension_to_mime_type(const std::string &extension) {
         return ngx_string("image/tiff");
     } else if (extension == ".gif") {
         return ngx_string("image/gif");
+    } else if (extension == ".avif") {
+        return ngx_string("image/avif");
+    } else if (extension == ".jxl") {
+        return ngx_string("image/jxl");
     } else { /*if (extension == ".json")*/
         return ngx_string("application/json");
     }
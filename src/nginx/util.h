@@ -4,7 +4,11 @@ extern "C" {
 #include <ngx_http.h>
 }
 
+#include "base64.h"
+
 #include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <string>
 
 namespace weserv {
@@ -27,9 +31,17 @@ bool has_valid_scheme(const ngx_str_t &url);
 bool is_base64_needed(ngx_http_request_t *r);
 
 /**
- * Converts an entire output chain to base64.
+ * Is the output format negotiated with the Accept request header?
+ * (i.e. `&output=auto`)
+ */
+bool is_auto_output_needed(ngx_http_request_t *r);
+
+/**
+ * Get the image formats within the Accept request header that are worth
+ * negotiating, as a comma-separated list (for e.g. `avif,webp`).
+ * Media ranges with a quality of zero are ignored.
  */
-ngx_int_t output_chain_to_base64(ngx_http_request_t *r, ngx_chain_t *out);
+std::string get_accepted_formats(ngx_http_request_t *r);
 
 /**
  * Get the Content-Disposition response header.
@@ -0,0 +1,94 @@
+#include "../nginx/base64.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using weserv::nginx::Base64Encoder;
+
+// The output is fed to the encoder in parts of the size of the output
+// buffers of a streamed response
+const size_t PART_SIZE = 32 * 1024;
+
+const int ITERATIONS = 20;
+
+/**
+ * Encode the input in parts, like a streamed response.
+ * @return The encoded size, in bytes.
+ */
+size_t encode_in_parts(const std::vector<uint8_t> &in,
+                       std::vector<uint8_t> *out) {
+    Base64Encoder encoder;
+    uint8_t *p = out->data();
+
+    for (size_t i = 0; i < in.size(); i += PART_SIZE) {
+        size_t length = std::min(PART_SIZE, in.size() - i);
+        p += encoder.encode(in.data() + i, length, p);
+    }
+    p += encoder.finish(p);
+
+    return p - out->data();
+}
+
+/**
+ * Encode the input at once, with the portable implementation.
+ * @return The encoded size, in bytes.
+ */
+size_t encode_scalar(const std::vector<uint8_t> &in,
+                     std::vector<uint8_t> *out) {
+    return weserv::nginx::encode_base64_groups_scalar(in.data(), in.size(),
+                                                      out->data());
+}
+
+template <typename Encode>
+double megabytes_per_second(const std::vector<uint8_t> &in,
+                            std::vector<uint8_t> *out, Encode encode) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        (void)encode(in, out);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    return static_cast<double>(in.size()) * ITERATIONS / elapsed.count() /
+           (1024 * 1024);
+}
+
+int main() {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    std::cout << std::fixed << std::setprecision(0);
+
+    for (size_t megabytes : {1, 2, 5, 10}) {
+        // A multiple of three, so that both encode the same groups
+        std::vector<uint8_t> in(megabytes * 1024 * 1024 / 3 * 3);
+        for (auto &b : in) {
+            b = static_cast<uint8_t>(byte(generator));
+        }
+
+        std::vector<uint8_t> expected(in.size() / 3 * 4);
+        std::vector<uint8_t> out(in.size() / 3 * 4 + 4);
+
+        size_t expected_size = encode_scalar(in, &expected);
+        size_t out_size = encode_in_parts(in, &out);
+        if (out_size != expected_size ||
+            std::memcmp(out.data(), expected.data(), expected_size) != 0) {
+            std::cerr << megabytes << " MB: output differs" << std::endl;
+            return 1;
+        }
+
+        std::cout << megabytes << " MB: "
+                  << megabytes_per_second(in, &expected, encode_scalar)
+                  << " MB/s scalar, "
+                  << megabytes_per_second(in, &out, encode_in_parts)
+                  << " MB/s streamed (dispatched)" << std::endl;
+    }
+
+    return 0;
+}
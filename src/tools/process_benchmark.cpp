@@ -0,0 +1,96 @@
+#include "cli_environment.h"
+
+#include <weserv/api_manager.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using weserv::api::utils::Status;
+
+const int ITERATIONS = 10;
+
+// The queries to time on each image. Run this with VIPS_CONCURRENCY=1 and
+// without to compare the (multithreaded) AVIF and JPEG XL encoders.
+// clang-format off
+const std::vector<std::pair<const char *, const char *>> CASES = {
+    // Resize, premultiplied when the image has an alpha channel
+    {"resize",             "w=300&output=png"},
+    // Brightness, contrast and gamma (a single LUT), and a filter followed
+    // by the saturation (a single recombination)
+    {"adjustments",        "w=300&bri=10&con=10&gam=2.2&output=jpg"},
+    {"filter+saturate",    "w=300&filt=sepia&sat=2&output=jpg"},
+    {"avif",               "w=1000&output=avif"},
+    {"jxl",                "w=1000&output=jxl"},
+    // Truecolour against palette-quantised PNG
+    {"png",                "output=png"},
+    {"png palette",        "output=png&palette=true"},
+    {"png 16 colours",     "output=png&palette=true&colours=16"},
+    // Baseline against the mozjpeg preset
+    {"jpeg",               "output=jpg"},
+    {"jpeg mozjpeg",       "output=jpg&mozjpeg=true"},
+};
+// clang-format on
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        std::cout << argv[0] << " image.png [image2.jpg] [...]" << std::endl;
+        return 1;
+    }
+
+    weserv::api::ApiManagerFactory weserv_factory;
+    auto api_manager = weserv_factory.create_api_manager(
+        std::unique_ptr<weserv::api::ApiEnvInterface>(new CliEnvironment()));
+
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ios::binary);
+        if (!file) {
+            std::cerr << argv[i] << ": can't be read" << std::endl;
+            return 1;
+        }
+
+        std::ostringstream in;
+        in << file.rdbuf();
+        std::string in_buf = in.str();
+
+        std::cout << argv[i] << " (" << in_buf.size() << " bytes)"
+                  << std::endl;
+
+        for (const auto &c : CASES) {
+            std::string out_buf;
+
+            // Warm up, this also checks if the output is supported
+            Status status = api_manager->process_buffer(c.second, in_buf,
+                                                        &out_buf);
+            if (!status.ok()) {
+                std::cout << "  " << std::left << std::setw(18) << c.first
+                          << "ERROR: " << status.message() << std::endl;
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (int j = 0; j < ITERATIONS; ++j) {
+                out_buf.clear();
+                (void)api_manager->process_buffer(c.second, in_buf,
+                                                  &out_buf);
+            }
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            std::cout << "  " << std::left << std::setw(18) << c.first
+                      << std::right << std::setw(8)
+                      << elapsed.count() / ITERATIONS << " ms "
+                      << std::setw(10) << out_buf.size() << " bytes"
+                      << std::endl;
+        }
+    }
+
+    return 0;
+}
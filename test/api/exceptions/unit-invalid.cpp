@@ -2,6 +2,10 @@
 
 #include "../base.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
 using Catch::Matchers::Contains;
 
 TEST_CASE("invalid image ", "[invalid]") {
@@ -25,6 +29,26 @@ TEST_CASE("invalid image ", "[invalid]") {
         CHECK_THAT(status.message(),
                    Contains("Invalid or unsupported image format"));
     }
+    SECTION("descriptor") {
+        char tmpname[] = "/tmp/invalidXXXXXX";
+        int fd = mkstemp(tmpname);
+        REQUIRE(fd != -1);
+
+        std::string test_buffer = "<!DOCTYPE html>";
+        REQUIRE(write(fd, test_buffer.c_str(), test_buffer.size()) ==
+                static_cast<ssize_t>(test_buffer.size()));
+
+        Status status = api_manager->process_descriptor("", fd, nullptr);
+
+        close(fd);
+        std::remove(tmpname);
+
+        CHECK(!status.ok());
+        CHECK(status.code() == static_cast<int>(Status::Code::InvalidImage));
+        CHECK(status.error_cause() == Status::ErrorCause::Application);
+        CHECK_THAT(status.message(),
+                   Contains("Invalid or unsupported image format"));
+    }
     SECTION("source") {
         class InvalidSource : public SourceInterface {
             int64_t read(void *data, size_t length) override {
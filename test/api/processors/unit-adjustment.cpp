@@ -0,0 +1,38 @@
+#include <catch2/catch.hpp>
+
+#include "../base.h"
+#include "../similar_image.h"
+
+#include <vips/vips8>
+
+using vips::VImage;
+
+TEST_CASE("adjustment", "[adjustment]") {
+    SECTION("combined") {
+        auto test_image = fixtures->input_png_with_transparency;
+        auto params = "w=320&bri=30&con=20&gam=2.2";
+
+        VImage image = process_file<VImage>(test_image, params);
+        VImage original = process_file<VImage>(test_image, "w=320");
+
+        CHECK(image.width() == 320);
+        CHECK(image.bands() == 4);
+        CHECK(image.format() == VIPS_FORMAT_UCHAR);
+        CHECK(image.has_alpha());
+
+        // Check if the alpha channel is passed through
+        CHECK((image[3] == original[3]).min() == 255.0);
+    }
+
+    SECTION("nothing to adjust") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=320&bri=0&con=0";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 320);
+
+        CHECK_THAT(image, is_similar_image(
+                              process_file<VImage>(test_image, "w=320")));
+    }
+}
@@ -233,3 +233,24 @@ TEST_CASE("skip height in toilet-roll mode", "[alignment]") {
     CHECK(image.width() == 300);
     CHECK(vips_image_get_page_height(image.get_image()) == 318);
 }
+
+TEST_CASE("smart crop each frame in toilet-roll mode", "[alignment]") {
+    if (vips_type_find("VipsOperation",
+                       pre_8_10 ? "gifload_buffer" : "gifload_source") == 0) {
+        SUCCEED("no gif support, skipping test");
+        return;
+    }
+    if (vips_type_find("VipsOperation", pre_8_10 ? "magicksave_buffer"
+                                                 : "magicksave_target") == 0) {
+        SUCCEED("no magick support, skipping test");
+        return;
+    }
+
+    auto test_image = fixtures->input_gif_animated;
+    auto params = "n=-1&w=300&h=300&fit=cover&a=entropy";
+
+    VImage image = process_file<VImage>(test_image, params);
+
+    CHECK(image.width() == 300);
+    CHECK(vips_image_get_page_height(image.get_image()) == 300);
+}
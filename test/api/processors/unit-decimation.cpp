@@ -0,0 +1,88 @@
+#include <catch2/catch.hpp>
+
+#include "../base.h"
+
+#include <vips/vips8>
+
+using Catch::Matchers::Contains;
+
+TEST_CASE("decimation", "[decimation]") {
+    if (vips_type_find("VipsOperation",
+                       pre_8_10 ? "gifload_buffer" : "gifload_source") == 0) {
+        SUCCEED("no gif support, skipping test");
+        return;
+    }
+
+    SECTION("max frames") {
+        auto test_image = fixtures->input_gif_animated;
+        auto params = "n=-1&maxframes=4&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("pages":4)"));
+        CHECK_THAT(buffer, Contains(R"("pageHeight":1050)"));
+    }
+
+    SECTION("frame rate") {
+        auto test_image = fixtures->input_gif_animated;
+        auto params = "n=-1&delay=100&fps=5&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        // Every other frame is dropped, its delay is accumulated
+        CHECK_THAT(buffer, Contains(R"("pages":4)"));
+        CHECK_THAT(buffer, Contains(R"("delay":[200,200,200,200])"));
+    }
+
+    SECTION("invalid") {
+        auto test_image = fixtures->input_gif_animated;
+        auto params = "n=-1&fps=0&maxframes=0&output=json";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("pages":8)"));
+    }
+}
+
+TEST_CASE("identical frames", "[decimation]") {
+    if (vips_type_find("VipsOperation", "tiffsave_buffer") == 0 ||
+        vips_type_find("VipsOperation",
+                       pre_8_10 ? "tiffload_buffer" : "tiffload_source") == 0) {
+        SUCCEED("no tiff support, skipping test");
+        return;
+    }
+
+    // A multi-page TIFF with a run of two identical frames
+    auto frame = VImage::black(32, 32);
+    std::vector<VImage> frames = {frame.new_from_image({255, 0, 0}),
+                                  frame.new_from_image({0, 255, 0}),
+                                  frame.new_from_image({0, 255, 0}),
+                                  frame.new_from_image({0, 0, 255})};
+    auto image =
+        VImage::arrayjoin(frames, VImage::option()->set("across", 1)).copy();
+    image.set("page-height", 32);
+
+    void *buf;
+    size_t size;
+    image.write_to_buffer(".tiff", &buf, &size);
+    std::string buffer(static_cast<char *>(buf), size);
+    g_free(buf);
+
+    SECTION("are merged") {
+        auto params = "n=-1&delay=100&output=json";
+
+        std::string json = process_buffer<std::string>(buffer, params);
+
+        CHECK_THAT(json, Contains(R"("pages":3)"));
+        CHECK_THAT(json, Contains(R"("delay":[100,200,100])"));
+    }
+
+    SECTION("are merged before dropping frames") {
+        auto params = "n=-1&delay=100&maxframes=2&output=json";
+
+        std::string json = process_buffer<std::string>(buffer, params);
+
+        CHECK_THAT(json, Contains(R"("pages":2)"));
+        CHECK_THAT(json, Contains(R"("delay":[100,300])"));
+    }
+}
@@ -93,6 +93,19 @@ TEST_CASE("negate filter", "[filter]") {
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 
+    SECTION("jpeg combined with saturate") {
+        auto test_image = fixtures->input_jpg;
+        auto expected_image = fixtures->expected_dir + "/negate.jpg";
+        auto params = "w=320&h=240&fit=cover&filt=negate&sat=1";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 320);
+        CHECK(image.height() == 240);
+
+        CHECK_THAT(image, is_similar_image(expected_image));
+    }
+
     SECTION("png") {
         auto test_image = fixtures->input_png;
         auto expected_image = fixtures->expected_dir + "/negate.png";
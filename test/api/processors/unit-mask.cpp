@@ -151,6 +151,21 @@ TEST_CASE("mask", "[mask]") {
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 
+    SECTION("cached") {
+        auto test_image = fixtures->input_jpg;
+        auto expected_image = fixtures->expected_dir + "/mask-heart.png";
+        auto params = "w=320&h=240&fit=cover&mask=heart";
+
+        // The second request should reuse the rasterized mask
+        process_file<VImage>(test_image, params);
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK(image.width() == 320);
+        CHECK(image.height() == 240);
+
+        CHECK_THAT(image, is_similar_image(expected_image));
+    }
+
     SECTION("png transparent") {
         auto test_image = fixtures->input_png_overlay_layer_0;
         auto expected_image = fixtures->expected_dir + "/mask-star-trans.png";
@@ -201,3 +216,34 @@ TEST_CASE("mask", "[mask]") {
         CHECK_THAT(image, is_similar_image(test_image));
     }
 }
+
+TEST_CASE("mask each frame in toilet-roll mode", "[mask]") {
+    if (vips_type_find("VipsOperation",
+                       pre_8_10 ? "gifload_buffer" : "gifload_source") == 0) {
+        SUCCEED("no gif support, skipping test");
+        return;
+    }
+    if (vips_type_find("VipsOperation", pre_8_10 ? "magicksave_buffer"
+                                                 : "magicksave_target") == 0) {
+        SUCCEED("no magick support, skipping test");
+        return;
+    }
+
+    auto test_image = fixtures->input_gif_animated;
+    auto params = "n=-1&w=300&h=300&fit=cover&mask=circle";
+
+    VImage image = process_file<VImage>(test_image, params);
+
+    int page_height = vips_image_get_page_height(image.get_image());
+
+    // The height is skipped in toilet-roll mode, see the alignment tests
+    CHECK(image.width() == 300);
+    CHECK(page_height == 318);
+    CHECK(image.height() == page_height * 8);
+    CHECK(image.has_alpha());
+
+    // The corners of each frame are cut out
+    CHECK(image.getpoint(0, 0)[3] == 0.0);
+    CHECK(image.getpoint(0, page_height)[3] == 0.0);
+    CHECK(image.getpoint(299, image.height() - 1)[3] == 0.0);
+}
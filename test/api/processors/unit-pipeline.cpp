@@ -0,0 +1,57 @@
+#include <catch2/catch.hpp>
+
+#include "../base.h"
+
+#include <vips/vips8>
+
+using Catch::Matchers::Contains;
+
+TEST_CASE("explain", "[pipeline]") {
+    SECTION("stages") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&sat=2&blur=2&explain=1";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("thumbnail",)"));
+        CHECK_THAT(buffer, Contains(R"("blur","saturate"])"));
+    }
+
+    SECTION("filter+saturate") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&filt=sepia&sat=2&explain=1";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("thumbnail","filter+saturate"])"));
+        CHECK_THAT(buffer, Contains(R"("blur","tint","background","mask")"));
+    }
+
+    SECTION("elide background") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&bg=red&explain=1";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("stages":["thumbnail"])"));
+        CHECK_THAT(buffer, Contains(R"("background")"));
+    }
+
+    SECTION("keep background") {
+        auto test_image = fixtures->input_png_with_transparency;
+        auto params = "w=300&bg=red&explain=1";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("thumbnail","background"])"));
+    }
+
+    SECTION("precrop") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "cx=2&cy=2&cw=20&ch=20&precrop=true&explain=1";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        CHECK_THAT(buffer, Contains(R"("stages":["crop","thumbnail"])"));
+    }
+}
@@ -52,6 +52,59 @@ TEST_CASE("rotation", "[rotation]") {
         CHECK(image.height() == 368);
     }
 
+    SECTION("by 5 degrees, streaming the input") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "ro=5&output=jpg";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        // 2725 * cos(5) + 2225 * sin(5) by 2725 * sin(5) + 2225 * cos(5)
+        CHECK(image.width() >= 2908);
+        CHECK(image.width() <= 2910);
+        CHECK(image.height() >= 2453);
+        CHECK(image.height() <= 2455);
+    }
+
+    SECTION("by 30 degrees, streaming a large input") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "ro=30&output=jpg";
+
+        // The tile cache is sized by the number of worker threads
+        int concurrency = vips_concurrency_get();
+        for (const auto &threads : {1, concurrency, 64}) {
+            vips_concurrency_set(threads);
+
+            VImage image = process_file<VImage>(test_image, params);
+
+            // 2725 * cos(30) + 2225 * sin(30) by
+            // 2725 * sin(30) + 2225 * cos(30)
+            CHECK(image.width() >= 3471);
+            CHECK(image.width() <= 3474);
+            CHECK(image.height() >= 3288);
+            CHECK(image.height() <= 3291);
+        }
+        vips_concurrency_set(concurrency);
+    }
+
+    SECTION("by 45 degrees, streaming a large input") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "ro=45&output=jpg";
+
+        int concurrency = vips_concurrency_get();
+        for (const auto &threads : {1, concurrency, 64}) {
+            vips_concurrency_set(threads);
+
+            VImage image = process_file<VImage>(test_image, params);
+
+            // (2725 + 2225) * sin(45) by (2725 + 2225) * cos(45)
+            CHECK(image.width() >= 3499);
+            CHECK(image.width() <= 3502);
+            CHECK(image.height() >= 3499);
+            CHECK(image.height() <= 3502);
+        }
+        vips_concurrency_set(concurrency);
+    }
+
     SECTION("by 30-multiple angle") {
         auto test_image = fixtures->input_jpg_320x240;
 
@@ -1,6 +1,7 @@
 #include <catch2/catch.hpp>
 
 #include "../base.h"
+#include "../max_color_distance.h"
 
 #include <cstdio>
 #include <fstream>
@@ -92,6 +93,41 @@ TEST_CASE("output", "[stream]") {
         CHECK(vips_image_get_page_height(image.get_image()) == 318);
     }
 
+    SECTION("avif") {
+        if (pre_8_10 ||
+            vips_type_find("VipsOperation", "heifsave_target") == 0) {
+            SUCCEED("no avif support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover&output=avif&effort=0";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("heifload_buffer"));
+
+        CHECK(image.width() == 300);
+        CHECK(image.height() == 300);
+    }
+
+    SECTION("jxl") {
+        if (vips_type_find("VipsOperation", "jxlsave_target") == 0) {
+            SUCCEED("no jxl support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover&output=jxl&effort=1";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("jxlload_buffer"));
+
+        CHECK(image.width() == 300);
+        CHECK(image.height() == 300);
+    }
+
     SECTION("png") {
         auto test_image = fixtures->input_png;
         auto params = "w=300&h=300&fit=cover";
@@ -127,6 +163,107 @@ TEST_CASE("output", "[stream]") {
         CHECK(image.height() == 300);
     }
 
+    SECTION("auto") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover&output=auto";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("jpegload_buffer"));
+
+        CHECK(image.width() == 300);
+        CHECK(image.height() == 300);
+    }
+
+    SECTION("auto webp") {
+        if (vips_type_find("VipsOperation",
+                           pre_8_10 ? "webpsave_buffer" : "webpsave_target") ==
+            0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=300&h=300&fit=cover&output=auto&accept=webp";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("webpload_buffer"));
+
+        CHECK(image.width() == 300);
+        CHECK(image.height() == 300);
+    }
+
+    SECTION("auto animated") {
+        if (vips_type_find("VipsOperation",
+                           pre_8_10 ? "webpsave_buffer" : "webpsave_target") ==
+            0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_gif_animated;
+        auto params = "n=-1&w=300&output=auto&accept=avif,webp";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        // AVIF can't hold an animation
+        CHECK_THAT(image.get_string("vips-loader"), Equals("webpload_buffer"));
+    }
+
+    SECTION("auto graphic") {
+        // A flat-colour graphic, saved as JPEG
+        auto red = VImage::black(100, 200).new_from_image({255, 0, 0});
+        auto blue = VImage::black(100, 200).new_from_image({0, 0, 255});
+
+        void *buf;
+        size_t size;
+        red.join(blue, VIPS_DIRECTION_HORIZONTAL)
+            .write_to_buffer(".jpg", &buf, &size);
+
+        std::string test_buffer(static_cast<char *>(buf), size);
+        g_free(buf);
+
+        auto params = "output=auto";
+
+        VImage image = process_buffer<VImage>(test_buffer, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("pngload_buffer"));
+
+        CHECK(image.width() == 200);
+        CHECK(image.height() == 200);
+    }
+
+    SECTION("auto smooth photo") {
+        // A smooth gradient with some sensor noise (like a clear sky), it
+        // has little texture but many colours
+        auto xyz = VImage::xyz(200, 200);
+        auto noise = VImage::gaussnoise(
+            200, 200, VImage::option()->set("mean", 0.0)->set("sigma", 1.0));
+
+        void *buf;
+        size_t size;
+        (xyz[0] + noise)
+            .bandjoin(xyz[1] + noise)
+            .bandjoin(VImage::black(200, 200) + 128 + noise)
+            .cast(VIPS_FORMAT_UCHAR)
+            .copy(VImage::option()->set("interpretation",
+                                        VIPS_INTERPRETATION_sRGB))
+            .write_to_buffer(".jpg", &buf, &size);
+
+        std::string test_buffer(static_cast<char *>(buf), size);
+        g_free(buf);
+
+        auto params = "output=auto";
+
+        VImage image = process_buffer<VImage>(test_buffer, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("jpegload_buffer"));
+
+        CHECK(image.width() == 200);
+        CHECK(image.height() == 200);
+    }
+
     SECTION("file") {
         auto test_image = fixtures->input_jpg;
         auto params = "w=300&h=300&fit=cover&output=jpg";
@@ -201,6 +338,46 @@ TEST_CASE("quality and compression", "[stream]") {
         CHECK(buffer_85.size() < buffer_95.size());
     }
 
+    SECTION("jpeg mozjpeg") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=320&h=240&fit=cover";
+        auto params_mozjpeg = "w=320&h=240&fit=cover&mozjpeg";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        std::string buffer_mozjpeg =
+            process_file<std::string>(test_image, params_mozjpeg);
+
+        // Equal without mozjpeg-capable libjpeg
+        CHECK(buffer_mozjpeg.size() <= buffer.size());
+    }
+
+    SECTION("jpeg maximum bytes") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=320&h=240&fit=cover&maxbytes=10000";
+        auto params_85 = "w=320&h=240&fit=cover";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        std::string buffer_85 =
+            process_file<std::string>(test_image, params_85);
+
+        CHECK(buffer.size() <= 10000);
+        CHECK(buffer.size() < buffer_85.size());
+    }
+
+    SECTION("jpeg auto quality") {
+        auto test_image = fixtures->input_jpg;
+        auto params = "w=320&h=240&fit=cover&q=auto";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("jpegload_buffer"));
+
+        CHECK(image.width() == 320);
+        CHECK(image.height() == 240);
+    }
+
     SECTION("png level") {
         auto test_image = fixtures->input_png;
         auto params_3 = "w=320&h=240&fit=cover&l=3";
@@ -218,6 +395,32 @@ TEST_CASE("quality and compression", "[stream]") {
         // CHECK(buffer_6.size() < buffer_9.size());
     }
 
+    SECTION("png palette") {
+        auto test_image = fixtures->input_png;
+        auto params = "w=320&h=240&fit=cover";
+        auto params_palette = "w=320&h=240&fit=cover&palette&colours=16";
+
+        std::string buffer = process_file<std::string>(test_image, params);
+
+        std::string buffer_palette =
+            process_file<std::string>(test_image, params_palette);
+
+        CHECK(buffer_palette.size() < buffer.size());
+    }
+
+    SECTION("png parallel deflate") {
+        auto test_image = fixtures->input_png;
+        auto params = "w=2400&h=2000&fit=fill&af";
+        auto params_parallel = "w=2400&h=2000&fit=fill&af&png_threads=4";
+
+        VImage expected = process_file<VImage>(test_image, params);
+        VImage image = process_file<VImage>(test_image, params_parallel);
+
+        CHECK(image.width() == 2400);
+        CHECK(image.height() == 2000);
+        CHECK_THAT(image, is_max_color_distance(expected, 0));
+    }
+
     SECTION("webp quality") {
         if (vips_type_find("VipsOperation",
                            pre_8_10 ? "webpload_buffer" : "webpload_source") ==
@@ -247,6 +450,44 @@ TEST_CASE("quality and compression", "[stream]") {
         CHECK(buffer_85.size() < buffer_95.size());
     }
 
+    SECTION("webp lossless") {
+        if (vips_type_find("VipsOperation",
+                           pre_8_10 ? "webpsave_buffer" : "webpsave_target") ==
+            0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_png;
+        auto params = "w=320&h=240&fit=cover&output=webp&lossless";
+
+        VImage image = process_file<VImage>(test_image, params);
+
+        CHECK_THAT(image.get_string("vips-loader"), Equals("webpload_buffer"));
+
+        CHECK(image.width() == 320);
+        CHECK(image.height() == 240);
+    }
+
+    SECTION("webp effort") {
+        if (vips_type_find("VipsOperation",
+                           pre_8_10 ? "webpsave_buffer" : "webpsave_target") ==
+            0) {
+            SUCCEED("no webp support, skipping test");
+            return;
+        }
+
+        auto test_image = fixtures->input_jpg;
+        auto params_0 = "w=320&h=240&fit=cover&output=webp&effort=0";
+        auto params_6 = "w=320&h=240&fit=cover&output=webp&effort=6";
+
+        std::string buffer_0 = process_file<std::string>(test_image, params_0);
+
+        std::string buffer_6 = process_file<std::string>(test_image, params_6);
+
+        CHECK(buffer_6.size() < buffer_0.size());
+    }
+
     SECTION("tiff quality") {
         if (vips_type_find("VipsOperation",
                            pre_8_10 ? "tiffload_buffer" : "tiffload_source") ==
@@ -473,6 +473,77 @@ TEST_CASE("from", "[thumbnail]") {
     }
 }
 
+TEST_CASE("embedded profile", "[thumbnail]") {
+    if (!vips_icc_present()) {
+        SUCCEED("no lcms support, skipping test");
+        return;
+    }
+
+    // Encode a few saturated colours (off the grey axis) to a PNG with the
+    // given built-in profile
+    auto with_profile = [](const char *name) -> std::string {
+        VipsBlob *profile;
+        if (vips_profile_load(name, &profile, nullptr) != 0) {
+            vips_error_clear();
+            return "";
+        }
+
+        auto square = VImage::black(32, 32);
+        auto image = VImage::black(64, 64)
+                         .new_from_image({200, 80, 60})
+                         .insert(square.new_from_image({255, 0, 0}), 0, 0)
+                         .insert(square.new_from_image({0, 255, 0}), 32, 0)
+                         .insert(square.new_from_image({0, 0, 255}), 0, 32)
+                         .copy(VImage::option()->set(
+                             "interpretation", VIPS_INTERPRETATION_sRGB));
+
+        size_t length;
+        const void *data = vips_blob_get(profile, &length);
+
+        // We don't take a copy of the profile, it's freed after saving
+        image.set(VIPS_META_ICC_NAME, nullptr, const_cast<void *>(data),
+                  length);
+
+        void *buf;
+        size_t size;
+        image.write_to_buffer(".png", &buf, &size);
+        vips_area_unref(reinterpret_cast<VipsArea *>(profile));
+
+        std::string buffer(static_cast<char *>(buf), size);
+        g_free(buf);
+
+        return buffer;
+    };
+
+    SECTION("sRGB is skipped") {
+        auto buffer = with_profile("srgb");
+        REQUIRE(!buffer.empty());
+
+        VImage input =
+            VImage::new_from_buffer(buffer.data(), buffer.size(), "");
+        VImage image = process_buffer<VImage>(buffer, "output=png");
+
+        // Untouched, a transform through lcms would round a few values
+        CHECK(image.width() == 64);
+        CHECK((image - input).abs().max() == 0.0);
+    }
+
+    SECTION("Display P3 is transformed") {
+        auto buffer = with_profile("p3");
+        if (buffer.empty()) {
+            SUCCEED("no built-in p3 profile, skipping test");
+            return;
+        }
+
+        VImage input =
+            VImage::new_from_buffer(buffer.data(), buffer.size(), "");
+        VImage image = process_buffer<VImage>(buffer, "output=png");
+
+        CHECK(image.width() == 64);
+        CHECK((image - input).abs().max() > 5.0);
+    }
+}
+
 TEST_CASE("shortest edge is at least 1 pixel", "[thumbnail]") {
     SECTION("height") {
         if (vips_type_find("VipsOperation", pre_8_10 ? "svgload_buffer"
@@ -581,3 +652,15 @@ TEST_CASE("radiance", "[thumbnail]") {
 
     CHECK_THAT(image, is_similar_image(expected_image));
 }
+
+TEST_CASE("8-bit with transparency", "[thumbnail]") {
+    auto test_image = fixtures->input_png_with_transparency;
+    auto params = "w=320";
+
+    VImage image = process_file<VImage>(test_image, params);
+
+    CHECK(image.width() == 320);
+    CHECK(image.bands() == 4);
+    CHECK(image.format() == VIPS_FORMAT_UCHAR);
+    CHECK(image.has_alpha());
+}
@@ -38,7 +38,7 @@ TEST_CASE("trim", "[trim]") {
         CHECK_THAT(image, is_similar_image(expected_image));
     }
 
-    SECTION("skip shrink-on-load") {
+    SECTION("shrink-on-load") {
         auto test_image = fixtures->input_jpg_overlay_layer_2;
         auto expected_image =
             fixtures->expected_dir + "/alpha-layer-2-trim-resize.jpg";
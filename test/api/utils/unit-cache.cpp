@@ -0,0 +1,85 @@
+#include <catch2/catch.hpp>
+
+#include "../base.h"
+
+#include <vips/vips8>
+
+#include "utils/cache.h"
+
+using weserv::api::utils::cache_stats;
+using weserv::api::utils::cached_image;
+
+TEST_CASE("constant image cache", "[cache]") {
+    int builds = 0;
+    auto build = [&builds](int width, int height) {
+        return [&builds, width, height]() {
+            ++builds;
+            return VImage::black(width, height);
+        };
+    };
+
+    SECTION("same operation and parameters") {
+        auto first = cached_image("maplut", {1.0, 2.0}, build(16, 1));
+        auto stats = cache_stats();
+        auto second = cached_image("maplut", {1.0, 2.0}, build(16, 1));
+
+        CHECK(builds == 1);
+        CHECK(first.get_image() == second.get_image());
+        CHECK(cache_stats().hits == stats.hits + 1);
+        CHECK(cache_stats().lookups == stats.lookups + 1);
+    }
+
+    SECTION("different parameters") {
+        cached_image("maplut", {3.0, 4.0}, build(16, 1));
+        cached_image("maplut", {3.0, 5.0}, build(16, 1));
+        cached_image("maplut", {4.0, 3.0}, build(16, 1));
+
+        CHECK(builds == 3);
+    }
+
+    SECTION("operation not on the allowlist") {
+        auto stats = cache_stats();
+        cached_image("conv", {6.0}, build(3, 3));
+        cached_image("conv", {6.0}, build(3, 3));
+
+        CHECK(builds == 2);
+        CHECK(cache_stats().lookups == stats.lookups);
+    }
+
+    SECTION("evicts beyond 64 entries") {
+        for (int i = 0; i < 65; ++i) {
+            cached_image("maplut", {7.0, static_cast<double>(i)}, build(16, 1));
+        }
+
+        CHECK(builds == 65);
+        CHECK(cache_stats().entries == 64);
+
+        // The least recently used entry is gone, the most recent one is kept
+        cached_image("maplut", {7.0, 64.0}, build(16, 1));
+        CHECK(builds == 65);
+        cached_image("maplut", {7.0, 0.0}, build(16, 1));
+        CHECK(builds == 66);
+    }
+
+    SECTION("evicts beyond 1 MiB") {
+        // 512 KiB each
+        cached_image("maplut", {8.0, 1.0}, build(512, 1024));
+        cached_image("maplut", {8.0, 2.0}, build(512, 1024));
+        cached_image("maplut", {8.0, 3.0}, build(512, 1024));
+
+        CHECK(builds == 3);
+        CHECK(cache_stats().memory <= 1024 * 1024);
+
+        cached_image("maplut", {8.0, 3.0}, build(512, 1024));
+        CHECK(builds == 3);
+        cached_image("maplut", {8.0, 1.0}, build(512, 1024));
+        CHECK(builds == 4);
+    }
+
+    SECTION("too large to cache") {
+        cached_image("maplut", {9.0}, build(1024, 1025));
+        cached_image("maplut", {9.0}, build(1024, 1025));
+
+        CHECK(builds == 2);
+    }
+}
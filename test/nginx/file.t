@@ -1,8 +1,10 @@
 #!/usr/bin/env perl
 
 use Test::Nginx::Socket;
+use MIME::Base64;
 
-plan tests => repeat_each() * (blocks() * 5);
+# TEST 5 and 6 send two requests
+plan tests => repeat_each() * (blocks() * 5 + 10);
 
 $ENV{TEST_NGINX_HTML_DIR} ||= html_dir();
 
@@ -34,6 +36,28 @@ sub gif_size {
    return join ' ', unpack("x6v2", $content);
 }
 
+# The body of the previous (not streamed) response
+our $Buffered;
+
+sub same_as_buffered {
+   my $content = shift;
+
+   if (!defined $Buffered) {
+       $Buffered = $content;
+       return 'buffered';
+   }
+
+   # Compare the image within a data URI
+   if ($content =~ m/^data:[^;]+;base64,(.*)$/s) {
+       $content = decode_base64($1);
+   }
+
+   my $same = $content eq $Buffered ? 'identical' : 'different';
+   undef $Buffered;
+
+   return $same;
+}
+
 no_long_string();
 #no_diff();
 
@@ -103,3 +127,235 @@ $::TestGif"
 --- no_error_log
 [error]
 [warn]
+
+
+=== TEST 4: streamed base64 output
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv on;
+        weserv_mode file;
+        weserv_streaming on;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif?encoding=base64
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+Content-Type: text/plain
+--- response_body_like: ^data:image/gif;base64,[A-Za-z0-9+/]+=*$
+--- no_error_log
+[error]
+[warn]
+
+
+
+=== TEST 5: streamed output larger than the output buffers
+--- http_config eval: $::HttpConfig
+--- config
+    location /buffered {
+        weserv on;
+        weserv_mode file;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+
+    location /streamed {
+        weserv on;
+        weserv_mode file;
+        weserv_streaming on;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request eval
+["GET /buffered/test.gif?w=400&h=400&fit=fill&output=png&l=0",
+ "GET /streamed/test.gif?w=400&h=400&fit=fill&output=png&l=0"]
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers eval
+["!Transfer-Encoding", "Transfer-Encoding: chunked"]
+--- response_body_filters eval
+\&::same_as_buffered
+--- response_body eval
+["buffered", "identical"]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 6: streamed base64 output larger than the output buffers
+--- http_config eval: $::HttpConfig
+--- config
+    location /buffered {
+        weserv on;
+        weserv_mode file;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+
+    location /streamed {
+        weserv on;
+        weserv_mode file;
+        weserv_streaming on;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request eval
+["GET /buffered/test.gif?w=400&h=400&fit=fill&output=png&l=0",
+ "GET /streamed/test.gif?w=400&h=400&fit=fill&output=png&l=0&encoding=base64"]
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers eval
+["!Transfer-Encoding", "Transfer-Encoding: chunked"]
+--- response_body_filters eval
+\&::same_as_buffered
+--- response_body eval
+["buffered", "identical"]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 7: conditional GET with If-Modified-Since
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv on;
+        weserv_mode file;
+        if_modified_since before;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif
+--- more_headers
+If-Modified-Since: Thu, 31 Dec 2037 23:55:55 GMT
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+Cache-Control: public, max-age=31536000
+--- response_body eval
+""
+--- error_code: 304
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 8: conditional GET with If-None-Match
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv on;
+        weserv_mode file;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif
+--- more_headers
+If-None-Match: *
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+Cache-Control: public, max-age=31536000
+--- response_body eval
+""
+--- error_code: 304
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 9: failed precondition with If-Match
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv on;
+        weserv_mode file;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/test.gif
+--- more_headers
+If-Match: "0-0"
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+Content-Type: text/html
+--- response_body_like: 412 Precondition Failed
+--- error_code: 412
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 10: HEAD request
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv on;
+        weserv_mode file;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    HEAD /images/test.gif
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+Content-Type: image/gif
+--- response_body eval
+""
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 11: file not found
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv on;
+        weserv_mode file;
+        log_not_found off;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- request
+    GET /images/missing.gif
+--- response_headers
+!Content-Disposition
+--- response_body_like: 404 Not Found
+--- error_code: 404
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 12: symbolic link with disable_symlinks
+--- http_config eval: $::HttpConfig
+--- config
+    location /images {
+        weserv on;
+        weserv_mode file;
+        disable_symlinks on;
+        alias $TEST_NGINX_HTML_DIR;
+    }
+--- init
+unlink("$ENV{TEST_NGINX_HTML_DIR}/link.gif");
+symlink("test.gif", "$ENV{TEST_NGINX_HTML_DIR}/link.gif")
+    or die "symlink failed: $!";
+--- request
+    GET /images/link.gif
+--- user_files eval
+">>> test.gif
+$::TestGif"
+--- response_headers
+!Content-Disposition
+--- response_body_like: 403 Forbidden
+--- error_code: 403
+--- error_log eval
+qr/\[error\] .*"[^"]*link\.gif" failed/
+--- no_error_log
+[warn]
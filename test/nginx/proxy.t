@@ -3,7 +3,8 @@
 use Test::Nginx::Socket;
 use Test::Nginx::Util qw($ServerPort $ServerAddr);
 
-plan tests => repeat_each() * (blocks() * 5);
+# TEST 6 - 13 send two requests
+plan tests => repeat_each() * (blocks() * 5 + 40);
 
 $ENV{TEST_NGINX_HTML_DIR} ||= html_dir();
 $ENV{TEST_NGINX_URI} = "http://$ServerAddr:$ServerPort";
@@ -12,6 +13,79 @@ our $HttpConfig = qq{
     error_log logs/error.log debug;
 };
 
+# The origin responds with a 1x1 image on a new connection and a 2x2 image
+# on a reused one
+our $KeepaliveConfig = qq{
+    error_log logs/error.log debug;
+
+    map \$connection_requests \$image_size {
+        1       1;
+        default 2;
+    }
+};
+
+our $TestGif = unhex(qq{
+0x0000:  47 49 46 38 39 61 01 00  01 00 80 01 00 00 00 00  |GIF89a.. ........|
+0x0010:  ff ff ff 21 f9 04 01 00  00 01 00 2c 00 00 00 00  |...!.... ...,....|
+0x0020:  01 00 01 00 00 02 02 4c  01 00 3b                 |.......L ..;|
+});
+
+# The same GIF, padded to 4 KiB with a comment extension (after the global
+# color table)
+our $LargeGif = substr($TestGif, 0, 19) . "\x21\xfe" .
+    ("\xff" . ("x" x 255)) x 16 . "\x00" . substr($TestGif, 19);
+
+sub unhex {
+    my ($input) = @_;
+    my $buffer = '';
+
+    for my $l ($input =~ m/:  +((?:[0-9a-f]{2,4} +)+) /gms) {
+        for my $v ($l =~ m/[0-9a-f]{2}/g) {
+            $buffer .= chr(hex($v));
+        }
+    }
+
+    return $buffer;
+}
+
+# A DNS server for the resolver tests, it resolves every name to 127.0.0.1,
+# except for names starting with "nxdomain."
+sub dns_reply {
+    my $query = shift;
+
+    my $id = substr($query, 0, 2);
+
+    # The question section, up to and including the type and class
+    my $end = index($query, "\0", 12) + 5;
+    my $question = substr($query, 12, $end - 12);
+
+    if ($question =~ m/^\x08nxdomain/) {
+        # Response, recursion desired and available, name error
+        return $id . pack("n5", 0x8183, 1, 0, 0, 0) . $question;
+    }
+
+    # Response, recursion desired and available, no error
+    return $id . pack("n5", 0x8180, 1, 1, 0, 0) . $question .
+        pack("n3Nn", 0xc00c, 1, 1, 3600, 4) . pack("C4", 127, 0, 0, 1);
+}
+
+# The body of the previous (in-memory) response
+our $Buffered;
+
+sub same_as_buffered {
+   my $content = shift;
+
+   if (!defined $Buffered) {
+       $Buffered = $content;
+       return 'buffered';
+   }
+
+   my $same = $content eq $Buffered ? 'identical' : 'different';
+   undef $Buffered;
+
+   return $same;
+}
+
 no_long_string();
 #no_diff();
 
@@ -165,3 +239,247 @@ Content-Type: application/json
 --- no_error_log
 [error]
 [warn]
+
+
+=== TEST 6: image spilled to a temporary file
+--- http_config eval: $::HttpConfig
+--- config
+    location /static {
+        alias $TEST_NGINX_HTML_DIR;
+    }
+
+    location /buffered {
+        weserv on;
+        weserv_mode proxy;
+    }
+
+    location /spilled {
+        weserv on;
+        weserv_mode proxy;
+        weserv_buffer_size 1k;
+    }
+--- request eval
+["GET /buffered?url=$ENV{TEST_NGINX_URI}/static/large.gif&w=10&output=png",
+ "GET /spilled?url=$ENV{TEST_NGINX_URI}/static/large.gif&w=10&output=png"]
+--- user_files eval
+">>> large.gif
+$::LargeGif"
+--- response_headers eval
+["Content-Type: image/png", "Content-Type: image/png"]
+--- response_body_filters eval
+\&::same_as_buffered
+--- response_body eval
+["buffered", "identical"]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 7: keepalive connection is reused
+--- http_config eval: $::KeepaliveConfig
+--- config
+    location /origin {
+        default_type image/svg+xml;
+        echo '<svg xmlns="http://www.w3.org/2000/svg" width="$image_size" height="$image_size"/>';
+    }
+
+    location /images {
+         weserv on;
+         weserv_mode proxy;
+    }
+--- request eval
+["GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json",
+ "GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json"]
+--- response_headers eval
+["Content-Type: application/json", "Content-Type: application/json"]
+--- response_body_like eval
+[qr/"format":"svg","width":1,"height":1,/,
+ qr/"format":"svg","width":2,"height":2,/]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 8: keepalive connection closed by the origin
+--- http_config eval: $::KeepaliveConfig
+--- config
+    location /origin {
+        default_type image/svg+xml;
+        keepalive_timeout 1ms;
+        echo '<svg xmlns="http://www.w3.org/2000/svg" width="$image_size" height="$image_size"/>';
+    }
+
+    location /images {
+         weserv on;
+         weserv_mode proxy;
+    }
+--- request eval
+["GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json",
+ "GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json"]
+--- response_headers eval
+["Content-Type: application/json", "Content-Type: application/json"]
+--- response_body_like eval
+[qr/"format":"svg","width":1,"height":1,/,
+ qr/"format":"svg","width":1,"height":1,/]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 9: Connection: close response header is honoured
+--- http_config eval: $::KeepaliveConfig
+--- config
+    location /origin {
+        default_type image/svg+xml;
+        add_header Connection close;
+        echo '<svg xmlns="http://www.w3.org/2000/svg" width="$image_size" height="$image_size"/>';
+    }
+
+    location /images {
+         weserv on;
+         weserv_mode proxy;
+    }
+--- request eval
+["GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json",
+ "GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json"]
+--- response_headers eval
+["Content-Type: application/json", "Content-Type: application/json"]
+--- response_body_like eval
+[qr/"format":"svg","width":1,"height":1,/,
+ qr/"format":"svg","width":1,"height":1,/]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 10: keepalive disabled
+--- http_config
+    error_log logs/error.log debug;
+
+    weserv_keepalive 0;
+
+    map $connection_requests $image_size {
+        1       1;
+        default 2;
+    }
+--- config
+    location /origin {
+        default_type image/svg+xml;
+        echo '<svg xmlns="http://www.w3.org/2000/svg" width="$image_size" height="$image_size"/>';
+    }
+
+    location /images {
+         weserv on;
+         weserv_mode proxy;
+    }
+--- request eval
+["GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json",
+ "GET /images?url=$ENV{TEST_NGINX_URI}/origin&output=json"]
+--- response_headers eval
+["Content-Type: application/json", "Content-Type: application/json"]
+--- response_body_like eval
+[qr/"format":"svg","width":1,"height":1,/,
+ qr/"format":"svg","width":1,"height":1,/]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 11: resolved addresses are cached
+--- http_config
+    error_log logs/error.log debug;
+
+    # An idle keepalive connection would skip the resolver, see TEST 13
+    weserv_keepalive 0;
+    weserv_resolver_cache 1m;
+--- config
+    location /origin {
+        default_type image/svg+xml;
+        echo '<svg xmlns="http://www.w3.org/2000/svg" width="1" height="1"/>';
+    }
+
+    location /images {
+         weserv on;
+         weserv_mode proxy;
+         resolver 127.0.0.1:1953 ipv6=off;
+         add_header X-Resolve-Cache $weserv_resolve_cache always;
+    }
+--- udp_listen: 1953
+--- udp_reply eval
+\&::dns_reply
+--- request eval
+["GET /images?url=http://origin.test:$ServerPort/origin&output=json",
+ "GET /images?url=http://origin.test:$ServerPort/origin&output=json"]
+--- response_headers eval
+["X-Resolve-Cache: MISS", "X-Resolve-Cache: HIT"]
+--- response_body_like eval
+[qr/"format":"svg","width":1,"height":1,/,
+ qr/"format":"svg","width":1,"height":1,/]
+--- no_error_log
+[error]
+[warn]
+
+
+=== TEST 12: nonexistent host names are cached
+--- http_config
+    error_log logs/error.log debug;
+
+    weserv_resolver_cache 1m;
+--- config
+    location /images {
+         weserv on;
+         weserv_mode proxy;
+         resolver 127.0.0.1:1953 ipv6=off;
+         add_header X-Resolve-Cache $weserv_resolve_cache always;
+    }
+--- udp_listen: 1953
+--- udp_reply eval
+\&::dns_reply
+--- request eval
+["GET /images?url=http://nxdomain.test/image.gif",
+ "GET /images?url=http://nxdomain.test/image.gif"]
+--- response_headers eval
+["X-Resolve-Cache: MISS", "X-Resolve-Cache: NEGATIVE"]
+--- response_body_like eval
+[qr/"code":404,"message":"The hostname of the origin is unresolvable/,
+ qr/"code":404,"message":"The hostname of the origin is unresolvable/]
+--- error_code eval
+[404, 404]
+--- error_log
+could not be resolved (3: Host not found)
+--- no_error_log
+[warn]
+
+
+
+=== TEST 13: the resolver is skipped for an idle keepalive connection
+--- http_config
+    error_log logs/error.log debug;
+
+    weserv_resolver_cache 1m;
+--- config
+    location /origin {
+        default_type image/svg+xml;
+        echo '<svg xmlns="http://www.w3.org/2000/svg" width="1" height="1"/>';
+    }
+
+    location /images {
+         weserv on;
+         weserv_mode proxy;
+         resolver 127.0.0.1:1953 ipv6=off;
+         add_header X-Resolve-Cache $weserv_resolve_cache always;
+    }
+--- udp_listen: 1953
+--- udp_reply eval
+\&::dns_reply
+--- request eval
+["GET /images?url=http://origin.test:$ServerPort/origin&output=json",
+ "GET /images?url=http://origin.test:$ServerPort/origin&output=json"]
+--- response_headers eval
+["X-Resolve-Cache: MISS", "X-Resolve-Cache: KEEPALIVE"]
+--- response_body_like eval
+[qr/"format":"svg","width":1,"height":1,/,
+ qr/"format":"svg","width":1,"height":1,/]
+--- no_error_log
+[error]
+[warn]